@@ -0,0 +1,299 @@
+#ifndef AUDIO_HPP_
+#define AUDIO_HPP_
+
+/** @file Audio clicks
+ * @brief Click samples rendered once, mixed by a real-time callback at sample-accurate positions on the beat clock
+ */
+
+#include "BeatPattern.hpp"
+#include "BeatScheduler.hpp"
+#include "Instrumentation.hpp"
+#include "SPSCQueue.hpp"
+
+#include <algorithm> //fill, min, max
+#include <array>     //array
+#include <atomic>    //atomic
+#include <chrono>    //std::chrono
+#include <cerrno>    //EINTR
+#include <cmath>     //sin, exp, llround
+#include <cstddef>   //size_t
+#include <cstdint>   //int16_t, uint32_t
+#include <cstdio>    //FILE
+#include <stdexcept> //exceptions
+#include <string>    //string
+#include <thread>    //thread
+#include <vector>    //vector
+
+#include <pthread.h> //pthread_setschedparam
+#include <sched.h>   //SCHED_FIFO
+#include <time.h>    //clock_nanosleep
+
+/** @brief Render a click: a sine burst with a 1ms attack and an exponential decay
+ * @param Rate       Sample rate (frames per second)
+ * @param Frequency  Pitch of the click (Hz)
+ * @param Gain       Peak amplitude (0-1)
+ * @param Seconds    Length of the sample
+ */
+inline std::vector<float> RenderClick(int Rate, float Frequency, float Gain, float Seconds = 0.03f) {
+	std::vector<float> ret((std::size_t)((float)Rate * Seconds));
+	const float Attack = 0.001f * (float)Rate;
+	const float Decay = Seconds * (float)Rate / 6.0f; //~-52dB by the end, so the cut-off is inaudible
+	for (std::size_t i = 0; i != ret.size(); i++) {
+		float T = (float)i;
+		float Envelope = std::min(T / Attack,1.0f) * std::exp(-T / Decay);
+		ret[i] = Gain * Envelope * std::sin(6.2831853f * Frequency * T / (float)Rate);
+	}
+	return ret;
+}
+
+/** @brief Mixes pre-rendered click samples into an audio stream at frames scheduled from the beat clock
+ * The stream's frame 0 is tied to a steady_clock time (the epoch), so a beat deadline converts directly into
+ * the frame the click starts on.  One thread schedules clicks (the timing thread) and one thread pulls audio
+ * (Process, the real-time callback); they share only a lock-free queue and a few atomics.  Process never
+ * allocates, locks or makes a system call.
+ */
+struct ClickEngine {
+	static constexpr int DefaultRate = 48000;        ///<Frames per second
+	static constexpr std::size_t MaxVoices = 8;      ///<Clicks that can sound at once
+private:
+	/** @brief A click on its way to the callback */
+	struct Click {
+		long long Frame = 0;  ///<Stream frame the click starts on
+		unsigned Session = 0; ///<Cancel() generation it was scheduled in
+		BeatEvent Event = BeatEvent::Beat; ///<Which sample to play
+	};
+	/** @brief A click the callback is playing (or about to) */
+	struct Voice {
+		long long Start;      ///<Stream frame of the first sample
+		unsigned Session;     ///<Cancel() generation it was scheduled in
+		float const *Data;    ///<Sample to play
+		std::size_t Length;   ///<Frames in the sample
+	};
+
+	int m_Rate;                                  ///<Frames per second
+	std::array<std::vector<float>,(std::size_t)BeatEvent::Count> m_Samples; ///<One per BeatEvent; rendered in the constructor, read-only afterwards
+	SPSCQueue<Click,64> m_Pending;               ///<Scheduler -> callback
+	std::array<Voice,MaxVoices> m_Voices;        ///<Callback only
+	std::size_t m_Active = 0;                    ///<Callback only: live entries of m_Voices
+	long long m_Position = 0;                    ///<Callback only: frame at the start of the next block
+	std::atomic<long long> m_Epoch {0};          ///<steady_clock nanoseconds of frame 0
+	std::atomic<long long> m_Latency {0};        ///<Nanoseconds between a frame being mixed and it being heard
+	std::atomic<unsigned> m_Session {0};         ///<Bumped by Cancel(); older clicks are discarded
+	std::atomic<long long> m_Late {0};           ///<Clicks that arrived after their frame had been mixed
+	std::atomic<long long> m_Dropped {0};        ///<Clicks lost to a full queue or no free voice
+public:
+	ClickEngine(const ClickEngine&) = delete;
+	ClickEngine& operator=(const ClickEngine&) = delete;
+
+	ClickEngine(int Rate = DefaultRate) : m_Rate(Rate),
+		m_Samples {RenderClick(Rate,1760.0f,0.9f),          //Downbeat
+		           RenderClick(Rate,1320.0f,0.75f),         //Accent
+		           RenderClick(Rate,880.0f,0.6f),           //Beat
+		           RenderClick(Rate,880.0f,0.3f,0.015f)} {} //Subdivision
+
+	/** @brief Frames per second */
+	int Rate() const {return m_Rate;}
+
+	/** @brief Tie stream frame 0 to a point in time (set before the stream starts) */
+	void SetEpoch(BeatScheduler::TimePoint Epoch) {
+		m_Epoch.store(std::chrono::duration_cast<std::chrono::nanoseconds>(Epoch.time_since_epoch()).count(),std::memory_order_release);
+	}
+
+	/** @brief Stream frame that plays at a point in time */
+	long long FrameAt(BeatScheduler::TimePoint T) const {
+		long long NS = std::chrono::duration_cast<std::chrono::nanoseconds>(T.time_since_epoch()).count() - m_Epoch.load(std::memory_order_acquire);
+		return std::llround((double)NS * (double)m_Rate / 1e9);
+	}
+
+	/** @brief Declare the output latency; clicks are mixed this far ahead so they are heard on time */
+	void SetLatency(std::chrono::nanoseconds Latency) {
+		m_Latency.store(std::max((long long)Latency.count(),0LL),std::memory_order_relaxed);
+	}
+
+	/** @brief Output latency (see SetLatency) */
+	std::chrono::nanoseconds Latency() const {return std::chrono::nanoseconds(m_Latency.load(std::memory_order_relaxed));}
+
+	/** @brief Queue a click to be heard exactly at a point in time (scheduling thread only)
+	 * @return false if the queue was full and the click was dropped
+	 */
+	bool Schedule(BeatScheduler::TimePoint When, BeatEvent Event) {
+		Click C;
+		C.Frame = FrameAt(When - Latency());
+		C.Session = m_Session.load(std::memory_order_relaxed);
+		C.Event = Event;
+		if (m_Pending.Push(C)) return true;
+		m_Dropped.fetch_add(1,std::memory_order_relaxed);
+		return false;
+	}
+
+	/** @brief Forget every click that has not started sounding yet (scheduling thread only) */
+	void Cancel() {
+		m_Session.fetch_add(1,std::memory_order_release);
+	}
+
+	/** @brief Real-time callback: mix the next block of mono audio into Out (overwriting it) */
+	void Process(float *Out, std::size_t Frames) {
+		std::fill(Out,Out + Frames,0.0f);
+		unsigned Session = m_Session.load(std::memory_order_acquire);
+		Click C;
+		while (m_Pending.Pop(C)) {
+			if (C.Session != Session) continue;
+			if (C.Frame < m_Position) { //scheduled too late for its frame: play it as soon as possible
+				m_Late.fetch_add(1,std::memory_order_relaxed);
+				C.Frame = m_Position;
+			}
+			if (m_Active == MaxVoices) {
+				m_Dropped.fetch_add(1,std::memory_order_relaxed);
+				continue;
+			}
+			std::vector<float> const &S = m_Samples[(std::size_t)C.Event];
+			m_Voices[m_Active++] = Voice{C.Frame,C.Session,S.data(),S.size()};
+		}
+		long long End = m_Position + (long long)Frames;
+		for (std::size_t i = 0; i < m_Active;) {
+			Voice const &V = m_Voices[i];
+			long long Stop = V.Start + (long long)V.Length;
+			bool Cancelled = (V.Session != Session && V.Start >= m_Position); //clicks already sounding ring out
+			if (!Cancelled && V.Start < End) {
+				long long From = std::max(V.Start,m_Position), To = std::min(Stop,End);
+				float *Dest = Out + (From - m_Position);
+				float const *Src = V.Data + (From - V.Start);
+				for (long long n = 0; n != To - From; n++) Dest[n] += Src[n];
+			}
+			if (Cancelled || Stop <= End) m_Voices[i] = m_Voices[--m_Active];
+			else i++;
+		}
+		m_Position = End;
+	}
+
+	/** @brief Clicks that were mixed later than scheduled */
+	long long Late() const {return m_Late.load(std::memory_order_relaxed);}
+
+	/** @brief Clicks that were never played */
+	long long Dropped() const {return m_Dropped.load(std::memory_order_relaxed);}
+};
+
+/** @brief Destination for the mixed audio (16-bit mono PCM) */
+struct AudioSink {
+	virtual ~AudioSink() = default;
+	/** @brief Consume a block of samples; may block like a sound card would */
+	virtual void Write(int16_t const *Samples, std::size_t Frames) = 0;
+	/** @brief Time between a sample being written and it being heard (eg: the device buffer) */
+	virtual std::chrono::nanoseconds Latency() const {return std::chrono::nanoseconds(0);}
+};
+
+/** @brief Discards the audio (counts it, so the engine can run without sound hardware) */
+struct NullAudioSink final : public AudioSink {
+private:
+	std::atomic<unsigned long long> m_Frames {0};
+public:
+	virtual void Write(int16_t const*, std::size_t Frames) override {
+		m_Frames.fetch_add(Frames,std::memory_order_relaxed);
+	}
+	/** @brief Frames written so far */
+	unsigned long long Frames() const {return m_Frames.load(std::memory_order_relaxed);}
+};
+
+/** @brief Writes the audio to a WAV file
+ * The header is written with streaming (maximum) sizes and patched on close when the file is seekable, so the
+ * path can also be a FIFO read by a player (eg: `aplay`) for live sound.
+ */
+struct WavAudioSink final : public AudioSink {
+private:
+	std::FILE *m_File = nullptr;    ///<Owning file handle
+	int m_Rate;                     ///<Frames per second
+	unsigned long long m_Frames = 0;///<Frames written so far
+
+	void Put32(uint32_t V) {
+		unsigned char B[4] = {(unsigned char)V,(unsigned char)(V >> 8),(unsigned char)(V >> 16),(unsigned char)(V >> 24)};
+		std::fwrite(B,1,4,m_File);
+	}
+	void Put16(uint16_t V) {
+		unsigned char B[2] = {(unsigned char)V,(unsigned char)(V >> 8)};
+		std::fwrite(B,1,2,m_File);
+	}
+	void Header(int Rate, uint32_t DataBytes) {
+		std::fwrite("RIFF",1,4,m_File); Put32(DataBytes == 0xFFFFFFFFu ? DataBytes : 36 + DataBytes);
+		std::fwrite("WAVEfmt ",1,8,m_File); Put32(16);
+		Put16(1); Put16(1);                           //PCM, mono
+		Put32((uint32_t)Rate); Put32((uint32_t)Rate * 2);
+		Put16(2); Put16(16);                          //block align, bits per sample
+		std::fwrite("data",1,4,m_File); Put32(DataBytes);
+	}
+public:
+	WavAudioSink(const WavAudioSink&) = delete;
+	WavAudioSink& operator=(const WavAudioSink&) = delete;
+
+	WavAudioSink(std::string const &Path, int Rate) : m_Rate(Rate) {
+		m_File = std::fopen(Path.c_str(),"wb");
+		if (!m_File) throw std::runtime_error("cannot open " + Path);
+		Header(Rate,0xFFFFFFFFu);
+	}
+	~WavAudioSink() {
+		if (!m_File) return;
+		std::fflush(m_File);
+		if (std::fseek(m_File,0,SEEK_SET) == 0) Header(m_Rate,(uint32_t)std::min(m_Frames * 2,0xFFFFFFFEull));
+		std::fclose(m_File);
+	}
+
+	virtual void Write(int16_t const *Samples, std::size_t Frames) override {
+		for (std::size_t i = 0; i != Frames; i++) Put16((uint16_t)Samples[i]);
+		m_Frames += Frames;
+	}
+};
+
+/** @brief Scheduling options for the audio thread */
+struct AudioThreadOptions {
+	bool RealTime = false;          ///<Request SCHED_FIFO for the audio thread
+	int Priority = 70;              ///<SCHED_FIFO priority (below the timing thread)
+	std::size_t BlockFrames = 256;  ///<Frames mixed per callback
+};
+
+/** @brief Drives a ClickEngine in real time, handing each mixed block to a sink
+ * Stands in for a sound card: block k is mixed at epoch + k * BlockFrames / Rate, so frame F of the stream
+ * corresponds to the moment epoch + F / Rate and a click lands on its beat deadline to the sample.
+ */
+struct AudioThread {
+	using Options = AudioThreadOptions;
+private:
+	ClickEngine &m_Engine;
+	AudioSink &m_Sink;
+	std::atomic<bool> m_Quit {false};
+	std::thread m_Thread;
+
+	void Run(Options O, BeatScheduler::TimePoint Epoch) {
+		if (O.RealTime) {
+			sched_param Param {};
+			Param.sched_priority = O.Priority;
+			pthread_setschedparam(pthread_self(), SCHED_FIFO, &Param); //EPERM without CAP_SYS_NICE/rtprio
+		}
+		std::vector<float> Mix(O.BlockFrames);
+		std::vector<int16_t> PCM(O.BlockFrames);
+		double BlockNanos = 1e9 * (double)O.BlockFrames / (double)m_Engine.Rate();
+		for (long long Block = 0; !m_Quit.load(std::memory_order_relaxed); Block++) {
+			timespec Until = ToTimespec(Epoch + std::chrono::nanoseconds(std::llround(BlockNanos * (double)Block)));
+			while (::clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &Until, nullptr) == EINTR) {}
+			{
+			ScopedTimer Timer(Metrics().AudioCallback);
+			m_Engine.Process(Mix.data(),Mix.size());
+			}
+			for (std::size_t i = 0; i != Mix.size(); i++) PCM[i] = (int16_t)std::llround(std::max(-1.0f,std::min(Mix[i],1.0f)) * 32767.0f);
+			m_Sink.Write(PCM.data(),PCM.size());
+		}
+	}
+public:
+	AudioThread(const AudioThread&) = delete;
+	AudioThread& operator=(const AudioThread&) = delete;
+
+	AudioThread(ClickEngine &Engine, AudioSink &Sink, Options O = Options()) : m_Engine(Engine), m_Sink(Sink) {
+		BeatScheduler::TimePoint Epoch = BeatScheduler::Clock::now();
+		m_Engine.SetEpoch(Epoch); //before anything can be scheduled against it
+		m_Thread = std::thread(&AudioThread::Run,this,O,Epoch);
+	}
+	~AudioThread() {
+		m_Quit = true;
+		m_Thread.join();
+	}
+};
+
+#endif
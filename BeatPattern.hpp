@@ -0,0 +1,85 @@
+#ifndef BEAT_PATTERN_HPP_
+#define BEAT_PATTERN_HPP_
+
+/** @file Beat patterns
+ * @brief Per-bar table of what each beat (and subdivision) of a time signature is, looked up in O(1)
+ */
+
+#include <array>   //array
+#include <cstddef> //size_t
+
+/** @brief What a step of the bar is, strongest first */
+enum class BeatEvent : unsigned char {
+	Downbeat = 0, ///<First beat of the bar
+	Accent,       ///<First beat of a group within the bar (eg: beat 3 of 4/4, beat 4 of 6/8)
+	Beat,         ///<Any other beat
+	Subdivision,  ///<Between two beats
+	Count         ///<Number of event types
+};
+
+/** @brief The events of one bar of a time signature, precomputed into a table
+ * A beat is one note of the signature's lower value (so BPM counts eighth notes in 6/8), and each beat is split
+ * into Subdivisions equal steps.  Beats are grouped the way the meter is usually felt, each group starting
+ * with an accent:
+ *   - compound meters (6/8, 9/8, 12/8...) in threes
+ *   - everything else in twos, with a final three for odd counts (5/4 = 2+3, 7/8 = 2+2+3)
+ *   - bars of three beats or fewer are one group
+ * Step 0 is the downbeat; At() is a single table lookup for any step count.
+ */
+struct BeatPattern {
+	static constexpr int MaxBeats = 32;        ///<Most beats in a bar
+	static constexpr int MaxSubdivisions = 4;  ///<Most steps per beat
+private:
+	std::array<BeatEvent,MaxBeats * MaxSubdivisions> m_Table {}; ///<Event of each step of the bar
+	int m_Beats = 1;         ///<Beats per bar
+	int m_Subdivisions = 1;  ///<Steps per beat
+	int m_Steps = 1;         ///<Steps per bar
+	int m_NoteValue = 4;     ///<Note value of a beat
+public:
+	/**
+	 * @param Upper         Beats per bar (clamped to [1,MaxBeats])
+	 * @param Lower         Note value of a beat (4: quarter, 8: eighth...)
+	 * @param Subdivisions  Steps per beat (clamped to [1,MaxSubdivisions])
+	 */
+	BeatPattern(int Upper = 4, int Lower = 4, int Subdivisions = 1) {
+		m_Beats = (Upper < 1) ? 1 : (Upper > MaxBeats) ? MaxBeats : Upper;
+		m_Subdivisions = (Subdivisions < 1) ? 1 : (Subdivisions > MaxSubdivisions) ? MaxSubdivisions : Subdivisions;
+		m_Steps = m_Beats * m_Subdivisions;
+		m_NoteValue = (Lower < 1) ? 1 : Lower;
+		bool Compound = Lower >= 8 && m_Beats > 3 && m_Beats % 3 == 0;
+		for (int Beat = 0; Beat != m_Beats; Beat++) {
+			m_Table[(std::size_t)(Beat * m_Subdivisions)] = BeatEvent::Beat;
+			for (int k = 1; k < m_Subdivisions; k++) m_Table[(std::size_t)(Beat * m_Subdivisions + k)] = BeatEvent::Subdivision;
+		}
+		for (int Beat = 0; Beat < m_Beats;) {
+			m_Table[(std::size_t)(Beat * m_Subdivisions)] = (Beat == 0) ? BeatEvent::Downbeat : BeatEvent::Accent;
+			int Left = m_Beats - Beat;
+			if (m_Beats <= 3) Beat += Left;
+			else if (Compound || Left == 3) Beat += 3;
+			else Beat += 2;
+		}
+	}
+
+	/** @brief Beats per bar */
+	int BeatsPerBar() const {return m_Beats;}
+
+	/** @brief Steps per beat */
+	int Subdivisions() const {return m_Subdivisions;}
+
+	/** @brief Note value of a beat (4: quarter, 8: eighth...) */
+	int NoteValue() const {return m_NoteValue;}
+
+	/** @brief Steps per bar */
+	int Steps() const {return m_Steps;}
+
+	/** @brief Event of a step, counted from a downbeat (negative steps count back from it) */
+	BeatEvent At(long long Step) const {
+		long long S = Step % m_Steps;
+		return m_Table[(std::size_t)(S < 0 ? S + m_Steps : S)];
+	}
+
+	/** @brief Event of a beat, counted from a downbeat */
+	BeatEvent AtBeat(long long Beat) const {return At(Beat * m_Subdivisions);}
+};
+
+#endif
@@ -0,0 +1,159 @@
+#ifndef BEAT_SCHEDULER_HPP_
+#define BEAT_SCHEDULER_HPP_
+
+/** @file Beat scheduler
+ * @brief Absolute-deadline beat clock with nanosecond resolution, following a tempo map
+ */
+
+#include "BeatPattern.hpp"
+#include "TempoMap.hpp"
+
+#include <chrono>  //std::chrono
+#include <cerrno>  //EINTR
+#include <cmath>   //llround, floor
+
+#include <time.h>  //clock_nanosleep
+
+/** @brief Convert a steady_clock time point into an absolute CLOCK_MONOTONIC timespec
+ * @note steady_clock is CLOCK_MONOTONIC on Linux, so the epochs are the same
+ */
+inline timespec ToTimespec(std::chrono::steady_clock::time_point T) {
+	auto NS = std::chrono::duration_cast<std::chrono::nanoseconds>(T.time_since_epoch()).count();
+	if (NS <= 0) NS = 1; //a zero timespec disarms timers
+	timespec ret;
+	ret.tv_sec = NS / 1000000000;
+	ret.tv_nsec = NS % 1000000000;
+	return ret;
+}
+
+/** @brief Keeps beat N's deadline as Anchor + Tempo.Time(N - Origin)
+ * The tempo map gives the time of every beat in closed form (N * period for a constant tempo), so the
+ * deadline of every beat is computed directly from the anchor and rounding error never accumulates
+ * from beat to beat, even through tempo ramps.  Start anchors beat 0; Retime moves the anchor to the
+ * (fractional) beat playing when the tempo changes, so the beat count and the phase within the beat carry
+ * straight on at the new tempo instead of the grid starting over.
+ */
+struct BeatScheduler {
+	using Clock = std::chrono::steady_clock;
+	using TimePoint = Clock::time_point;
+	using Nanoseconds = std::chrono::nanoseconds;
+
+	/** @brief A delivered beat */
+	struct Tick {
+		long long Index = 0;     ///<Beat number from the start of the grid
+		TimePoint Deadline;      ///<When the beat was due
+		Nanoseconds Lateness {0};///<How late the beat was delivered
+		long long Missed = 0;    ///<Beats that were skipped because they were already in the past
+		Nanoseconds Lead {0};    ///<How far ahead of Deadline the beat was issued (latency compensation)
+		BeatEvent Event = BeatEvent::Beat; ///<Place of the beat in the bar (filled in from the BeatPattern)
+		Nanoseconds Length {0};  ///<Time from Deadline to the following beat
+	};
+private:
+	TimePoint m_Anchor = Clock::now();    ///<Time of beat Origin
+	double m_Origin = 0.0;                ///<(Fractional) beat the tempo map starts from
+	TempoMap m_Tempo = TempoMap::Constant(120.0f); ///<Time of every beat after Origin (prepared)
+	long long m_NextBeat = 1;             ///<Index of the next beat to be delivered
+	Tick m_LastTick;                      ///<The last delivered beat
+public:
+	BeatScheduler() = default;
+
+	/** @brief Anchor beat 0 at First; the first delivered beat is one period later */
+	void Start(TimePoint First, double BPM) {
+		Start(First,TempoMap::Constant((float)BPM));
+	}
+
+	/** @brief Anchor beat 0 of a (prepared) tempo map at First
+	 * @param NextBeat  First beat to deliver (eg: to join a grid that started in the past)
+	 */
+	void Start(TimePoint First, TempoMap const &Tempo, long long NextBeat = 1) {
+		m_Anchor = First;
+		m_Origin = 0.0;
+		m_Tempo = Tempo;
+		m_NextBeat = NextBeat;
+		m_LastTick = Tick();
+		m_LastTick.Deadline = First;
+	}
+
+	/** @brief Carry on from the beat playing at Now with a new (prepared) tempo map, keeping the beat count and phase */
+	void Retime(TimePoint Now, TempoMap const &Tempo) {
+		double Beat = Position(Now);
+		m_Anchor = Now;
+		m_Origin = Beat;
+		m_Tempo = Tempo;
+	}
+
+	/** @brief Keep the next beat's deadline and follow a new (prepared) tempo map from it */
+	void RetimeAtNextBeat(TempoMap const &Tempo) {
+		Align(m_NextBeat,NextDeadline(),Tempo);
+	}
+
+	/** @brief Move beat N to a point in time and follow a new (prepared) tempo map from it (eg: to follow an external clock) */
+	void Align(long long N, TimePoint At, TempoMap const &Tempo) {
+		m_Anchor = At;
+		m_Origin = (double)N;
+		m_Tempo = Tempo;
+	}
+
+	/** @brief (Fractional) beat at a point in time */
+	double Position(TimePoint T) const {
+		return m_Origin + m_Tempo.BeatAt((double)(T - m_Anchor).count());
+	}
+
+	/** @brief Time of a (fractional) beat (before the last retime, at the tempo the map starts with) */
+	TimePoint At(double Beat) const {
+		return m_Anchor + Nanoseconds(std::llround(m_Tempo.Time(Beat - m_Origin)));
+	}
+
+	/** @brief Deadline of beat N */
+	TimePoint Deadline(long long N) const {return At((double)N);}
+
+	/** @brief Deadline of the next beat to be delivered */
+	TimePoint NextDeadline() const {return Deadline(m_NextBeat);}
+
+	/** @brief Nanoseconds from the next beat to be delivered to the one after it */
+	double Period() const {
+		double Next = (double)m_NextBeat - m_Origin;
+		return m_Tempo.Time(Next + 1.0) - m_Tempo.Time(Next);
+	}
+
+	/** @brief The tempo the beats follow */
+	TempoMap const &Tempo() const {return m_Tempo;}
+
+	/** @brief Index of the next beat to be delivered */
+	long long NextBeat() const {return m_NextBeat;}
+
+	/** @brief The most recently delivered beat */
+	Tick const &LastTick() const {return m_LastTick;}
+
+	/** @brief Deliver the next beat if it is due at Now
+	 * @return true if a beat was delivered (Delivered is then filled in)
+	 */
+	bool Poll(TimePoint Now, Tick &Delivered) {
+		if (Now < NextDeadline()) return false;
+		Delivered = Tick();
+		//Skip straight to the latest beat that has passed rather than replaying a backlog
+		long long Latest = (long long)std::floor(Position(Now));
+		if (Latest < m_NextBeat) Latest = m_NextBeat;
+		while (Deadline(Latest) > Now) Latest -= 1; //guard against rounding of the division
+		while (Deadline(Latest + 1) <= Now) Latest += 1;
+		Delivered.Missed = Latest - m_NextBeat;
+		Delivered.Index = Latest;
+		Delivered.Deadline = Deadline(Latest);
+		Delivered.Lateness = Now - Delivered.Deadline;
+		Delivered.Length = Deadline(Latest + 1) - Delivered.Deadline;
+		m_NextBeat = Latest + 1;
+		m_LastTick = Delivered;
+		return true;
+	}
+
+	/** @brief Sleep until the next beat is due and deliver it */
+	Tick WaitForNextBeat() {
+		Tick ret;
+		timespec Until = ToTimespec(NextDeadline());
+		while (::clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &Until, nullptr) == EINTR) {}
+		while (!Poll(Clock::now(), ret)) {} //clock_nanosleep can return a hair early on some kernels
+		return ret;
+	}
+};
+
+#endif
@@ -0,0 +1,386 @@
+/** @file Microbenchmarks
+ * @brief Times the drawing paths that have to fit inside a frame; run ChristoffBenchmark after a Release build
+ */
+
+#include "Audio.hpp"
+#include "BeatScheduler.hpp"
+#include "DrawSystemHeadless.hpp"
+#include "Instrumentation.hpp"
+#include "Midi.hpp"
+#include "TapTempo.hpp"
+#include "TempoMap.hpp"
+
+#include <array>    //array
+#include <atomic>   //atomic
+#include <chrono>   //steady_clock
+#include <algorithm> //max
+#include <cmath>    //sin, cos
+#include <cstdlib>  //atoll, malloc
+#include <new>      //bad_alloc
+#include <random>   //mt19937
+#include <utility>  //pair
+#include <iomanip>  //setw
+#include <iostream> //cout
+
+/** @brief Number of heap allocations made by the whole program (counted by the replaced operator new) */
+static std::atomic<unsigned long long> HeapAllocations {0};
+
+void* operator new(std::size_t Size) {
+	HeapAllocations.fetch_add(1,std::memory_order_relaxed);
+	if (void *P = std::malloc(Size ? Size : 1)) return P;
+	throw std::bad_alloc();
+}
+//kept out of line so GCC does not pair the free() with a new-expression and warn
+__attribute__((noinline)) void operator delete(void *P) noexcept {std::free(P);}
+__attribute__((noinline)) void operator delete(void *P, std::size_t) noexcept {std::free(P);}
+
+/** @brief Column headings matching LatencyHistogram::Report */
+static void PrintHeader() {
+	std::cout << "Benchmark (microseconds)\n"
+	          << std::left << std::setw(18) << "" << std::right
+	          << std::setw(10) << "count" << std::setw(11) << "p50" << std::setw(11) << "p99"
+	          << std::setw(11) << "p99.9" << std::setw(11) << "max" << '\n';
+}
+
+/** @brief Draw a swinging pendulum (rod, bob and base) into a 300x100 window at many phases */
+static void BenchmarkRasterizer(long long Frames, SubCellMode Mode, const char* Name) {
+	headless_WindowHandle Win(100,300,0,0);
+	Win.SetResolution(Mode);
+	LatencyHistogram DrawTime;
+	Position<float> Pivot {150.0f,5.0f};
+	for (long long i = 0; i != Frames; i++) {
+		float Angle = 0.8f * std::sin((float)i * 0.05f);
+		Position<float> Bob {Pivot.X + 80.0f * std::sin(Angle), Pivot.Y + 80.0f * std::cos(Angle)};
+		auto Start = std::chrono::steady_clock::now();
+		Win.FillScreen({0,0,0,0});
+		Win.DrawTriangle({-20.0f,99.0f},{20.0f,99.0f},{0.0f,80.0f},{6,0,0,255},1.0f,{150.0f,0.0f},true,{4,0,0,255});
+		Win.DrawLine(Pivot,Bob,3.0f);
+		Win.DrawCircle(12.0f,Bob,{9,0,0,255},2.0f,true,{2,0,0,255});
+		Win.Refresh();
+		DrawTime.Record(std::chrono::steady_clock::now() - Start);
+	}
+	DrawTime.Report(std::cout,Name);
+	std::cout << "  " << Win.CellsOutput() / (unsigned long long)Frames << " changed cells per frame\n";
+}
+
+/** @brief Replay the cached pendulum swing in a 300x100 window (erase the old frame, blit the new one, present) */
+static void BenchmarkPendulumCache(long long Frames) {
+	headless_WindowHandle Win(100,300,0,0);
+	LatencyHistogram BuildTime, DrawTime;
+	PendulumCache Pendulum;
+	auto Start = std::chrono::steady_clock::now();
+	Pendulum.Build(Win,120.0f,4);
+	BuildTime.Record(std::chrono::steady_clock::now() - Start);
+	int Previous = -1;
+	for (long long i = 0; i != Frames; i++) {
+		int Frame = (int)(i % Pendulum.Phases());
+		Start = std::chrono::steady_clock::now();
+		if (Previous >= 0) Win.DrawSprite(Pendulum.Frame(Previous),true);
+		Win.DrawSprite(Pendulum.Frame(Frame));
+		Win.Refresh();
+		DrawTime.Record(std::chrono::steady_clock::now() - Start);
+		Previous = Frame;
+	}
+	BuildTime.Report(std::cout,"Pendulum cache");
+	DrawTime.Report(std::cout,"  cached frame");
+}
+
+/** @brief Move and draw a full pool of raindrops in a 300x100 window */
+static void BenchmarkRaindrops(long long Frames) {
+	headless_WindowHandle Win(100,300,0,0);
+	LatencyHistogram DrawTime;
+	static RainSystem Rain; //too large for the stack
+	std::size_t Peak = 0;
+	for (long long i = 0; i != Frames; i++) {
+		auto Start = std::chrono::steady_clock::now();
+		if (i % 30 == 0) { //a beat every 30 frames; keep the pool full
+			while (Rain.Count() + 150 <= RainSystem::Capacity) Rain.SpawnWave(Visualization::ParticlesTopDown,Win.GetSize(),std::chrono::milliseconds(500));
+		}
+		Rain.Update(std::chrono::nanoseconds(16666667));
+		Win.FillScreen({0,0,0,0});
+		Rain.Draw(Win,4);
+		Win.Refresh();
+		DrawTime.Record(std::chrono::steady_clock::now() - Start);
+		Peak = std::max(Peak,Rain.Count());
+	}
+	DrawTime.Report(std::cout,"Raindrops");
+	std::cout << "  up to " << Peak << " drops\n";
+}
+
+/** @brief Change a UI field every frame and redraw the input panel; in steady state this must not allocate */
+static void BenchmarkUserInterface(long long Frames) {
+	HeadlessDrawer Drawer;
+	Drawer.CreateInputWindow();
+	Drawer.CreateVisualWindow();
+	UserInterface UI;
+	LatencyHistogram DrawTime;
+	UI.MoveSelection(1); //BPM
+	Drawer.PrintUI(UI);
+	Drawer.Refresh();
+	unsigned long long Before = HeapAllocations.load();
+	for (long long i = 0; i != Frames; i++) {
+		auto Start = std::chrono::steady_clock::now();
+		if (i % 4 == 3) UI.MoveSelection((i & 4) ? -1 : 1);
+		else UI.SetBPM(UI.BPM + ((i & 1) ? 0.5f : -0.25f));
+		Drawer.PrintUI(UI);
+		Drawer.Refresh();
+		DrawTime.Record(std::chrono::steady_clock::now() - Start);
+	}
+	unsigned long long Allocations = HeapAllocations.load() - Before;
+	DrawTime.Report(std::cout,"UI panel");
+	std::cout << "  " << (double)Allocations / (double)Frames << " heap allocations per frame\n";
+}
+
+/** @brief Hide a pointer's target from the optimizer, so calls through a base class stay virtual */
+template <typename T>
+static T *Opaque(T *P) {
+	asm volatile("" : "+r"(P));
+	return P;
+}
+
+/** @brief Draw frames of a visualization, with a beat every 30 frames; returns nanoseconds per frame */
+template <typename Visual, typename Window>
+static double VisualFrames(Visual &V, Window &Win, UserInterface const &UI, long long Frames) {
+	auto Start = std::chrono::steady_clock::now();
+	for (long long i = 0; i != Frames; i++) {
+		if (i % 30 == 0) {
+			BeatScheduler::Tick T;
+			T.Index = i / 30;
+			T.Deadline = std::chrono::steady_clock::now();
+			V.OnBeat(T);
+		}
+		V.DrawFlash(UI);
+		V.DrawMetronome(UI);
+		V.DrawRaindrops(UI);
+		V.DrawProgress(UI);
+		Win.Refresh();
+	}
+	return (double)std::chrono::nanoseconds(std::chrono::steady_clock::now() - Start).count() / (double)Frames;
+}
+
+/** @brief Per-frame cost of the render path bound at compile time against the same path through virtual calls */
+static void BenchmarkDispatch(long long Frames) {
+	const std::pair<unsigned char,const char*> Selections[] = {{0,"pendulum"},{1,"raindrops"},{5,"progress"},{9,"flash only"}};
+	std::cout << "Render path dispatch (nanoseconds per frame, 80x17 window)\n";
+	for (auto const &Sel : Selections) {
+		UserInterface UI;
+		for (unsigned char i = 0; i != Sel.first; i++) UI.SetVisualization(1);
+		UI.ToggleFlashing();
+		headless_WindowHandle VirtualWin(17,80,0,0), StaticWin(17,80,0,0);
+		WindowVisual<WindowHandle> Virtual(&VirtualWin,true);
+		WindowVisual<headless_WindowHandle> Static(&StaticWin,true);
+		double VirtualTime = VisualFrames(*Opaque<VisualOutput>(&Virtual),*Opaque<WindowHandle>(&VirtualWin),UI,Frames);
+		double StaticTime = VisualFrames(Static,StaticWin,UI,Frames);
+		std::cout << "  " << std::left << std::setw(12) << Sel.second << std::right << " virtual " << std::setw(8) << VirtualTime << "   static " << std::setw(8) << StaticTime << '\n';
+	}
+}
+
+/** @brief Mix 256-frame blocks with overlapping clicks scheduled every few blocks; the callback must not allocate */
+static void BenchmarkClickEngine(long long Blocks) {
+	ClickEngine Engine;
+	auto Epoch = std::chrono::steady_clock::now();
+	Engine.SetEpoch(Epoch);
+	std::array<float,256> Out;
+	LatencyHistogram MixTime;
+	float Peak = 0.0f;
+	unsigned long long Before = HeapAllocations.load();
+	for (long long i = 0; i != Blocks; i++) {
+		if (i % 3 == 0) { //a click every 768 frames, so several are always sounding at once
+			long long Frame = (i + 1) * (long long)Out.size() + (i % 7) * 13;
+			Engine.Schedule(Epoch + std::chrono::nanoseconds(Frame * 1000000000LL / Engine.Rate()),(i % 12 == 0) ? BeatEvent::Downbeat : BeatEvent::Beat);
+		}
+		auto Start = std::chrono::steady_clock::now();
+		Engine.Process(Out.data(),Out.size());
+		MixTime.Record(std::chrono::steady_clock::now() - Start);
+		Peak = std::max(Peak,*Opaque(&Out[(std::size_t)i % Out.size()]));
+	}
+	unsigned long long Allocations = HeapAllocations.load() - Before;
+	MixTime.Report(std::cout,"Click mix 256");
+	std::cout << "  " << (double)Allocations / (double)Blocks << " heap allocations per block, " << Engine.Late() << " late clicks, peak " << Peak << '\n';
+}
+
+/** @brief Cost of a beat time from a tempo map, and how far summing whole-nanosecond periods drifts from it
+ * The map ramps 100 to 180 BPM and back and then holds, for two hours; the drift is what a clock that adds each
+ * beat's (rounded) length to the last deadline would be off by at the end.
+ */
+static void BenchmarkTempoMap(long long Lookups) {
+	TempoMap Map;
+	Map.Parse("64@100-180,64@180~100,8@100,1@97");
+	Map.Prepare(4);
+	long long Beats = (long long)Map.BeatAt(2.0 * 3600e9);
+	long long Summed = 0;
+	long long MaxDrift = 0;
+	for (long long N = 0; N != Beats; N++) {
+		Summed += std::llround(Map.Time((double)N + 1.0) - Map.Time((double)N));
+		MaxDrift = std::max(MaxDrift,std::abs(Summed - std::llround(Map.Time((double)N + 1.0))));
+	}
+	LatencyHistogram LookupTime;
+	double Sink = 0.0;
+	for (long long i = 0; i != Lookups; i++) {
+		auto Start = std::chrono::steady_clock::now();
+		for (long long k = 0; k != 64; k++) Sink += Map.Time((double)((i * 64 + k) % Beats));
+		LookupTime.Record(std::chrono::steady_clock::now() - Start);
+	}
+	LookupTime.Report(std::cout,"Tempo map x64");
+	std::cout << "  " << Beats << " beats in 2h, summed periods drift up to " << MaxDrift << "ns (closed form: 0)" << (Sink < 0.0 ? "!" : "") << '\n';
+	//before beat 0 the first tempo carries back, both for a map and for a single tempo
+	TempoMap Steady = TempoMap::Constant(90.0f);
+	double BackError = 0.0;
+	for (double Beat = -16.0; Beat < 0.0; Beat += 0.25) {
+		BackError = std::max(BackError,std::abs(Steady.Time(Beat) - Beat * 60e9 / 90.0));
+		BackError = std::max(BackError,std::abs(Map.Time(Beat) - Beat * 60e9 / 100.0));
+		BackError = std::max(BackError,std::abs(Steady.BeatAt(Steady.Time(Beat)) - Beat) * 60e9 / 90.0);
+		BackError = std::max(BackError,std::abs(Map.BeatAt(Map.Time(Beat)) - Beat) * 60e9 / 100.0);
+	}
+	std::cout << "  beats before beat 0 are off by up to " << BackError << "ns (should be under 1)\n";
+}
+
+/** @brief Change the tempo of a running beat grid at random moments and measure how far the grid jumps
+ * A third of the changes are immediate, which must keep the phase within the current beat; a third take over at
+ * the next beat, which must keep its deadline; the rest move the next beat by up to 10ms as following an external
+ * clock does.  Either way the beat count (and so the bar) must carry on, and the beats after the change must keep
+ * the new tempo, as must the half beat before the next one (where the subdivision clicks and MIDI clock pulses
+ * of the beat playing are placed again).  The phase error of restarting the grid instead is shown for comparison.
+ */
+static void BenchmarkTempoChanges(long long Changes) {
+	BeatScheduler Beats;
+	auto Start = BeatScheduler::Clock::now();
+	auto Now = Start;
+	double BPM = 120.0;
+	Beats.Start(Start,BPM);
+	std::mt19937 Random(2024);
+	std::uniform_real_distribution<double> Tempo(30.0,300.0), Wait(0.0,3.0), Shift(-10e6,10e6);
+	LatencyHistogram RetimeTime;
+	double MaxPhaseError = 0.0, MaxPeriodError = 0.0, MaxHalfError = 0.0, RestartError = 0.0;
+	long long BeatSkips = 0;
+	BeatScheduler::Tick T;
+	for (long long i = 0; i != Changes; i++) {
+		Now += std::chrono::nanoseconds(std::llround(Wait(Random) * 60e9 / BPM)); //up to three beats later
+		while (Beats.Poll(Now,T)) {}
+		double Before = Beats.Position(Now);
+		long long Next = Beats.NextBeat();
+		auto NextDeadline = Beats.NextDeadline();
+		BPM = Tempo(Random);
+		auto Moved = NextDeadline + std::chrono::nanoseconds(std::llround(Shift(Random)));
+		auto Begin = std::chrono::steady_clock::now();
+		switch (i % 3) {
+		case 0: Beats.Retime(Now,TempoMap::Constant((float)BPM)); break;
+		case 1: Beats.RetimeAtNextBeat(TempoMap::Constant((float)BPM)); break;
+		default: Beats.Align(Next,Moved,TempoMap::Constant((float)BPM)); break;
+		}
+		RetimeTime.Record(std::chrono::steady_clock::now() - Begin);
+		double Period = 60e9 / (double)(float)BPM;
+		//immediately: the rest of the beat plays at the new tempo; at the next beat: that beat keeps its deadline
+		auto Expected = (i % 3 == 0) ? Now + std::chrono::nanoseconds(std::llround(((double)Next - Before) * Period)) : (i % 3 == 1) ? NextDeadline : Moved;
+		double PhaseError = (double)(Beats.NextDeadline() - Expected).count();
+		MaxPhaseError = std::max(MaxPhaseError,std::abs(PhaseError));
+		RestartError += (Before - std::floor(Before)) * Period; //a restart puts the current position back to a beat
+		if (Beats.NextBeat() != Next) BeatSkips += 1;
+		double Length = (double)(Beats.Deadline(Next + 2) - Beats.Deadline(Next + 1)).count();
+		MaxPeriodError = std::max(MaxPeriodError,std::abs(Length - Period));
+		double Half = (double)(Beats.Deadline(Next) - Beats.At((double)Next - 0.5)).count();
+		MaxHalfError = std::max(MaxHalfError,std::abs(Half - Period / 2.0));
+	}
+	RetimeTime.Report(std::cout,"Tempo change");
+	std::cout << "  " << Changes << " changes: phase error up to " << MaxPhaseError << "ns, beat length error up to " << MaxPeriodError
+	          << "ns, half beat before the change off by up to " << MaxHalfError << "ns, " << BeatSkips
+	          << " beats lost (restarting instead: " << RestartError / (double)Changes / 1e6 << "ms jump on average)\n";
+}
+
+/** @brief Feed the tap tempo estimator taps with human-sized jitter, stray taps and missed taps
+ * Runs of 16 taps at random tempos with 10ms of jitter; one tap in 40 is a stray halfway between beats and one
+ * in 40 is missed.  The estimate after each run should land within a BPM, and a tap must not allocate.
+ */
+static void BenchmarkTapTempo(long long Taps) {
+	TapTempo Estimator;
+	std::mt19937 Random(7);
+	std::uniform_real_distribution<double> Tempo(70.0,240.0); //slower, a missed tap would be a pause that starts a new run
+	std::normal_distribution<double> Jitter(0.0,10e6);
+	std::uniform_int_distribution<int> Mishap(0,39);
+	LatencyHistogram TapTime;
+	double TotalError = 0.0;
+	long long Runs = 0, Close = 0;
+	auto Now = std::chrono::steady_clock::now();
+	unsigned long long Before = HeapAllocations.load();
+	for (long long i = 0; i < Taps; Runs++) {
+		double BPM = Tempo(Random), Period = 60e9 / BPM;
+		Now += std::chrono::seconds(3); //a pause starts a new run
+		auto Beat = Now;
+		for (int k = 0; k != 16 && i < Taps; k++, i++) {
+			Beat += std::chrono::nanoseconds(std::llround(Period));
+			int M = Mishap(Random);
+			if (M == 0 && k > 2) continue; //missed
+			auto At = Beat + std::chrono::nanoseconds(std::llround(Jitter(Random)));
+			if (M == 1 && k > 2) At -= std::chrono::nanoseconds(std::llround(Period / 2.0)); //stray
+			auto Start = std::chrono::steady_clock::now();
+			Estimator.Tap(At);
+			TapTime.Record(std::chrono::steady_clock::now() - Start);
+		}
+		Now = Beat;
+		double Error = std::abs(Estimator.BPM() - BPM);
+		Close += (Error < 1.0);
+		TotalError += Error;
+	}
+	unsigned long long Allocations = HeapAllocations.load() - Before;
+	TapTime.Report(std::cout,"Tap tempo");
+	std::cout << "  " << Runs << " runs of 16 taps: error " << TotalError / (double)Runs << " BPM on average, " << 100.0 * (double)Close / (double)Runs << "% within 1 BPM, "
+	          << (double)Allocations / (double)Taps << " heap allocations per tap\n";
+}
+
+/** @brief Follow a simulated MIDI clock with 1ms of jitter through a jump from 120 to 132 BPM
+ * Reports how long the follower takes to lock (from the first pulse, and again after the jump), the error of
+ * its prediction of each beat made halfway through the beat before (what the beat grid is aligned to) against
+ * the error of the raw clock byte, and the cost of a byte.
+ */
+static void BenchmarkClockFollower(long long Pulses) {
+	constexpr int PPQN = MidiClockFollower::PPQN;
+	MidiClockFollower Follower;
+	std::mt19937 Random(11);
+	std::normal_distribution<double> Jitter(0.0,1e6);
+	LatencyHistogram FeedTime, Predicted, Raw;
+	auto Start = std::chrono::steady_clock::now();
+	double True = 0.0, BPM = 120.0;
+	long long Jump = std::max(Pulses / 2,(long long)PPQN * 16) / PPQN * PPQN;
+	std::chrono::nanoseconds LockTime(-1), RelockTime(-1);
+	double Prediction = 0.0;
+	Follower.Feed(MidiStart,Start);
+	for (long long N = 0; N < std::max(Pulses,Jump * 2); N++) {
+		if (N == Jump) BPM = 132.0;
+		auto At = Start + std::chrono::nanoseconds(std::llround(True + Jitter(Random)));
+		auto Begin = std::chrono::steady_clock::now();
+		Follower.Feed(MidiClock,At);
+		FeedTime.Record(std::chrono::steady_clock::now() - Begin);
+		if (Follower.Locked() && N < Jump && LockTime.count() < 0) LockTime = Follower.LockTime();
+		if (Follower.Locked() && N > Jump && RelockTime.count() < 0) RelockTime = Follower.LockTime();
+		bool Steady = Follower.Locked() && (N < Jump || RelockTime.count() >= 0);
+		if (N % PPQN == 0 && Prediction != 0.0 && Steady) {
+			Predicted.Record(std::llabs(std::llround(Prediction - True)));
+			Raw.Record(std::llabs((long long)std::chrono::nanoseconds(At - Start).count() - std::llround(True)));
+		}
+		if (N % PPQN == PPQN / 2 && Follower.HasTempo()) Prediction = (double)std::chrono::nanoseconds(Follower.PulseAt((N / PPQN + 1) * PPQN) - Start).count();
+		True += 60e9 / BPM / PPQN;
+	}
+	FeedTime.Report(std::cout,"Clock follower");
+	Raw.Report(std::cout,"  raw beat error");
+	Predicted.Report(std::cout,"  followed error");
+	std::cout << "  locked after " << (double)LockTime.count() / 1e6 << " ms, and " << (double)RelockTime.count() / 1e6 << " ms after a jump to 132 BPM\n";
+}
+
+int main(int argc, char** argv) {
+	long long Frames = (argc > 1) ? std::atoll(argv[1]) : 10000;
+	if (Frames <= 0) Frames = 10000;
+	PrintHeader();
+	BenchmarkRasterizer(Frames,SubCellMode::Cell,"Pendulum 300x100");
+	BenchmarkRasterizer(Frames,SubCellMode::HalfBlock,"  half blocks");
+	BenchmarkRasterizer(Frames,SubCellMode::Braille,"  Braille");
+	BenchmarkPendulumCache(Frames);
+	BenchmarkRaindrops(Frames);
+	BenchmarkUserInterface(Frames);
+	BenchmarkDispatch(Frames);
+	BenchmarkClickEngine(Frames);
+	BenchmarkTempoMap(Frames);
+	BenchmarkTempoChanges(Frames);
+	BenchmarkTapTempo(Frames);
+	BenchmarkClockFollower(Frames);
+	return 0;
+}
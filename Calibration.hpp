@@ -0,0 +1,65 @@
+#ifndef CALIBRATION_HPP_
+#define CALIBRATION_HPP_
+
+/** @file Latency calibration
+ * @brief Measures how far the flash the player sees is from the beat, by having them tap along with it
+ */
+
+#include <algorithm> //nth_element
+#include <array>     //array
+#include <chrono>    //std::chrono
+#include <cmath>     //llround
+#include <cstddef>   //size_t
+
+/** @brief Collects taps made in time with the flash and reports their median offset from the beat grid
+ * Tapping along with a regular beat is anticipatory (people do not react to each flash, they predict it), so the
+ * offset of a tap from the beat it belongs to is how late the flash appears, not the player's reaction time.
+ * The median of a fixed number of taps ignores the odd tap that is a whole beat off.
+ */
+struct LatencyCalibrator {
+	using TimePoint = std::chrono::steady_clock::time_point;
+	static constexpr std::size_t Taps = 16; ///<Taps needed for a measurement
+private:
+	std::array<long long,Taps> m_Offsets {}; ///<Offset of each tap from its nearest beat (nanoseconds)
+	std::size_t m_Count = 0;                 ///<Taps recorded so far
+	bool m_Active = false;                   ///<Whether taps are being collected
+public:
+	/** @brief Forget any previous measurement and start collecting taps */
+	void Start() {
+		m_Count = 0;
+		m_Active = true;
+	}
+
+	/** @brief Whether taps are being collected */
+	bool Active() const {return m_Active;}
+
+	/** @brief Taps recorded so far */
+	std::size_t Count() const {return m_Count;}
+
+	/** @brief Record a tap
+	 * @param At      When the tap arrived
+	 * @param Beat    Deadline of any beat near the tap
+	 * @param Period  Nanoseconds per beat
+	 * @return true when this tap completed the measurement (see Offset)
+	 */
+	bool Tap(TimePoint At, TimePoint Beat, double Period) {
+		if (!m_Active || Period <= 0.0) return false;
+		double Since = (double)std::chrono::nanoseconds(At - Beat).count();
+		Since -= std::round(Since / Period) * Period; //offset from the nearest beat, in [-Period/2,Period/2]
+		m_Offsets[m_Count++] = std::llround(Since);
+		if (m_Count != Taps) return false;
+		m_Active = false;
+		return true;
+	}
+
+	/** @brief Median offset of the taps from the beat (positive: the flash is seen late) */
+	std::chrono::nanoseconds Offset() const {
+		if (m_Count == 0) return std::chrono::nanoseconds(0);
+		std::array<long long,Taps> Sorted = m_Offsets;
+		auto Middle = Sorted.begin() + (std::ptrdiff_t)(m_Count / 2);
+		std::nth_element(Sorted.begin(),Middle,Sorted.begin() + (std::ptrdiff_t)m_Count);
+		return std::chrono::nanoseconds(*Middle);
+	}
+};
+
+#endif
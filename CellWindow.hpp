@@ -0,0 +1,187 @@
+#ifndef CELL_WINDOW_HPP_
+#define CELL_WINDOW_HPP_
+
+/** @file Cell windows
+ * @brief WindowHandle primitives implemented once on top of a CellFramebuffer, shared by every backend
+ */
+
+#include "Interface.hpp"
+#include "Framebuffer.hpp"
+#include "Rasterizer.hpp"
+#include "SubCell.hpp"
+#include "Types.hpp"
+
+#include <algorithm> //min
+#include <cmath>     //floor, ceil
+#include <cstddef>   //size_t
+
+/** @brief A window whose contents live in a CellFramebuffer; draws primitives with the cell rasterizer
+ * Backends only provide the framebuffer (Derived::Frame()) and the way it reaches the terminal.  The backend is
+ * a template parameter (CRTP), so reaching the framebuffer from a primitive is a direct, inlinable call.
+ */
+template <typename Derived>
+struct CellWindow : public WindowHandle {
+	using Glyph = CellFramebuffer::Glyph;
+	using Attr = CellFramebuffer::Attr;
+protected:
+	Glyph m_BackgroundGlyph = ' '; ///<Glyph of the last FillScreen
+	Attr m_BackgroundAttr = 0;     ///<Attribute of the last FillScreen
+	Glyph m_PenGlyph = '#';        ///<Glyph used by DrawLine (the last border colour drawn)
+	Attr m_PenAttr = 0;            ///<Attribute used by DrawLine
+	char m_Border = 0;             ///<Border character (0 for line-drawing characters)
+	bool m_Boxed = true;           ///<Whether FillScreen redraws the border
+	Rasterizer m_Raster;           ///<Rasterizer (owns scratch space reused between frames)
+	SubCellCanvas m_Canvas;        ///<Pixels drawn at sub-cell resolution (unused in SubCellMode::Cell)
+
+	/** @brief Cell contents of the window (provided by the backend) */
+	CellFramebuffer &Cells() {return static_cast<Derived&>(*this).Frame();}
+
+	/** @brief Fill the framebuffer with the background (and border) and clear the sub-cell canvas */
+	void Repaint() {
+		CellFramebuffer &F = Cells();
+		F.Fill(m_BackgroundGlyph,m_BackgroundAttr);
+		if (m_Boxed) F.DrawBorder(m_BackgroundAttr,m_Border);
+		if (m_Canvas.Mode() == SubCellMode::Cell) return;
+		if (m_Canvas.Width() != F.Width() * m_Canvas.PixelsX() || m_Canvas.Height() != F.Height() * m_Canvas.PixelsY()) m_Canvas.Resize(m_Canvas.Mode(),F.Width(),F.Height());
+		else m_Canvas.Clear();
+	}
+
+	/** @brief Pack sub-cell pixels into the framebuffer; backends call this before presenting it */
+	void Resolve() {
+		if (m_Canvas.Mode() != SubCellMode::Cell) m_Canvas.Pack(Cells(),m_BackgroundGlyph,m_BackgroundAttr);
+	}
+
+	/** @brief Convert a point from cells to canvas pixels */
+	Position<float> ToPixels(Position<float> const &P, Position<float> const &Offset = {0,0}) const {
+		return {(P.X + Offset.X) * (float)m_Canvas.PixelsX(), (P.Y + Offset.Y) * (float)m_Canvas.PixelsY()};
+	}
+public:
+	virtual ~CellWindow() = default;
+
+	/** Convert a colour to a cell the following way:
+	 * R G B channels will be used to determine colour pair, as colour pairs will be limited:
+	 * R=2: BLUE
+	 * R=3: TEAL
+	 * R=4: GREEN
+	 * R=5: ORANGE
+	 * R=6: RED
+	 * R=7: PURPLE
+	 * R=8: BLACK
+	 * R=9: WHITE
+	 * A channel will determine whether a character is also printed to screen.  The A channel will print based on the following:
+	 * A < 25:  print '`'
+	 * A < 50:  print '"'
+	 * A < 75:  print '-'
+	 * A < 100: print '~'
+	 * A < 125: print ':'
+	 * A < 150: print '*'
+	 * A < 175: print '+'
+	 * A < 200: print '%'
+	 * A < 225: print 'O'
+	 * A < 250: print '8'
+	 * A = 255: '#' and fills entire block;
+	 */
+	static void ToCell(ColorType<unsigned char> Color, Glyph &G, Attr &A) {
+		static const char Ramp[] = "`\"-~:*+%O8#"; //A in (0,25], (25,50], ... (250,255)
+		G = ' ';
+		A = 0;
+		if (Color.A == 255) {
+			if (Color.R > 10) Color.R -= 10;
+			G = '#';
+			A = Color.R;
+		} else if (Color.A > 0) {
+			if (Color.R < 10) Color.R += 10;
+			G = (unsigned char)Ramp[std::min((Color.A - 1) / 25,10)];
+			A = Color.R;
+		}
+	}
+
+	/** @brief Rasterize primitives at sub-cell resolution; pixels are square in the sub-cell modes, so lengths are scaled by the horizontal pixel count */
+	virtual void SetResolution(SubCellMode Mode) override {
+		m_Canvas.Resize(Mode,Cells().Width(),Cells().Height());
+		Repaint();
+	}
+
+	/* Primitive draws */
+	virtual void DrawCircle(float Radius, Position<float> const &Loc, ColorType<unsigned char> Border, float BorderThickness, bool Fill = false, ColorType<unsigned char> FillColor = {0,0,0,0}) override {
+		Glyph G; Attr A;
+		ToCell(Border,m_PenGlyph,m_PenAttr);
+		if (m_Canvas.Mode() != SubCellMode::Cell) {
+			float Scale = (float)m_Canvas.PixelsX();
+			if (Fill) {ToCell(FillColor,G,A); m_Raster.FillCircle(m_Canvas,ToPixels(Loc),Radius * Scale,G,A);}
+			if (BorderThickness > 0.0f) m_Raster.CircleOutline(m_Canvas,ToPixels(Loc),Radius * Scale,BorderThickness * Scale,m_PenGlyph,m_PenAttr);
+			return;
+		}
+		if (Fill) {ToCell(FillColor,G,A); m_Raster.FillCircle(Cells(),Loc,Radius,G,A);}
+		if (BorderThickness > 0.0f) m_Raster.CircleOutline(Cells(),Loc,Radius,BorderThickness,m_PenGlyph,m_PenAttr);
+	}
+	virtual void DrawTriangle(Position<float> const &Pt1, Position<float> const &Pt2, Position<float> const &Pt3, ColorType<unsigned char> Border, float BorderThickness, Position<float> const &Offset = {0,0}, bool Fill = false, ColorType<unsigned char> FillColor = {0,0,0,0}) override {
+		Glyph G; Attr A;
+		ToCell(Border,m_PenGlyph,m_PenAttr);
+		if (m_Canvas.Mode() != SubCellMode::Cell) {
+			Position<float> P1 = ToPixels(Pt1,Offset), P2 = ToPixels(Pt2,Offset), P3 = ToPixels(Pt3,Offset);
+			if (Fill) {ToCell(FillColor,G,A); m_Raster.FillTriangle(m_Canvas,P1,P2,P3,G,A);}
+			if (BorderThickness > 0.0f) m_Raster.TriangleOutline(m_Canvas,P1,P2,P3,BorderThickness * (float)m_Canvas.PixelsX(),m_PenGlyph,m_PenAttr);
+			return;
+		}
+		Position<float> P1 {Pt1.X + Offset.X, Pt1.Y + Offset.Y};
+		Position<float> P2 {Pt2.X + Offset.X, Pt2.Y + Offset.Y};
+		Position<float> P3 {Pt3.X + Offset.X, Pt3.Y + Offset.Y};
+		if (Fill) {ToCell(FillColor,G,A); m_Raster.FillTriangle(Cells(),P1,P2,P3,G,A);}
+		if (BorderThickness > 0.0f) m_Raster.TriangleOutline(Cells(),P1,P2,P3,BorderThickness,m_PenGlyph,m_PenAttr);
+	}
+	/** @brief Draw a line in the colour of the last border drawn */
+	virtual void DrawLine(Position<float> const &Pt1, Position<float> const &Pt2, float Thickness, Position<float> const &Offset = {0,0}) override {
+		if (m_Canvas.Mode() != SubCellMode::Cell) {
+			m_Raster.Line(m_Canvas,ToPixels(Pt1,Offset),ToPixels(Pt2,Offset),Thickness * (float)m_Canvas.PixelsX(),m_PenGlyph,m_PenAttr);
+			return;
+		}
+		m_Raster.Line(Cells(),{Pt1.X + Offset.X, Pt1.Y + Offset.Y},{Pt2.X + Offset.X, Pt2.Y + Offset.Y},Thickness,m_PenGlyph,m_PenAttr);
+	}
+
+	/** @brief Fill the cells (or sub-cell pixels) whose centres lie in [Pt1,Pt2); adjacent rectangles never overlap */
+	virtual void DrawRect(Position<float> const &Pt1, Position<float> const &Pt2, ColorType<unsigned char> FillColor) override {
+		Glyph G; Attr A;
+		ToCell(FillColor,G,A);
+		auto Edge = [](float V) {return (int)std::ceil(V - 0.5f);};
+		if (m_Canvas.Mode() != SubCellMode::Cell) {
+			Position<float> P1 = ToPixels(Pt1), P2 = ToPixels(Pt2);
+			for (int Y = Edge(P1.Y); Y < Edge(P2.Y); Y++) m_Canvas.FillRow(Y,Edge(P1.X),Edge(P2.X),G,A);
+			return;
+		}
+		Cells().FillRect(Edge(Pt1.Y),Edge(Pt1.X),Edge(Pt2.Y),Edge(Pt2.X),G,A);
+	}
+	virtual void DrawPoints(float const *X, float const *Y, std::size_t N, ColorType<unsigned char> Color) override {
+		Glyph G; Attr A;
+		ToCell(Color,G,A);
+		if (m_Canvas.Mode() != SubCellMode::Cell) {
+			float SX = (float)m_Canvas.PixelsX(), SY = (float)m_Canvas.PixelsY();
+			for (std::size_t i = 0; i != N; i++) m_Canvas.Set((int)std::floor(Y[i] * SY),(int)std::floor(X[i] * SX),G,A);
+			return;
+		}
+		CellFramebuffer &F = Cells();
+		for (std::size_t i = 0; i != N; i++) F.Set((int)std::floor(Y[i]),(int)std::floor(X[i]),G,A);
+	}
+
+	/** @brief Capture the inside of the window (everything but the border) that differs from the background */
+	virtual void CaptureSprite(CellSprite &S) override {
+		Resolve();
+		CellFramebuffer &F = Cells();
+		int Inset = m_Boxed ? 1 : 0;
+		F.Capture(S,m_BackgroundGlyph,m_BackgroundAttr,Inset,Inset,F.Height() - Inset,F.Width() - Inset);
+	}
+	/** @brief Draw a captured sprite, or erase it with the current background */
+	virtual void DrawSprite(CellSprite const &S, bool Erase = false) override {
+		Resolve();
+		if (Erase) Cells().FillSprite(S,m_BackgroundGlyph,m_BackgroundAttr);
+		else Cells().Blit(S);
+	}
+
+	/** @brief Fill the window with a colour (see ToCell) */
+	virtual void FillScreen(ColorType<unsigned char> FillColor) override {
+		ToCell(FillColor,m_BackgroundGlyph,m_BackgroundAttr);
+		Repaint();
+	}
+};
+
+#endif
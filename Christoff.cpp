@@ -1,4 +1,14 @@
+#include "Audio.hpp"
+#include "DrawSystemAnsi.hpp"
+#include "DrawSystemHeadless.hpp"
 #include "DrawSystemNcurses.hpp"
+#include "EventLoop.hpp"
+#include "Midi.hpp"
+
+#include <climits>  //LLONG_MAX
+#include <cmath>    //isfinite
+#include <cstdlib>  //strtod, strtoll
+#include <iostream> //cout, cerr
 
 const char* TheWarning = R"EOL(
 ~~~~~~~~~~~~~~~~WARNING!~~~~~~~~~~~~~~~~~~~
@@ -9,7 +19,195 @@ To continue, press 'y'.
 Press any other key to exit.  
 )EOL";
 
-int main(int, char**) {
+/** @brief Milliseconds from the command line as a duration
+ * @return false (leaving Out unchanged) unless the whole argument is a finite, non-negative number
+ */
+bool Milliseconds(const char* Arg, std::chrono::nanoseconds &Out) {
+	char *End;
+	double Value = std::strtod(Arg,&End);
+	if (End == Arg || *End != '\0' || !std::isfinite(Value) || Value < 0.0 || Value > 1e9) return false; //1e9ms: far beyond any real latency, and within a long long of nanoseconds
+	Out = std::chrono::nanoseconds((long long)(Value * 1e6));
+	return true;
+}
+
+/** @brief Settings from the command line shared by every way of running */
+struct RunOptions {
+	TimingThread::Options Clock;                 ///<Beat clock scheduling (and the click engine)
+	SubCellMode Resolution = SubCellMode::Cell;  ///<Resolution of the visuals
+	Location Layout = Location::North;           ///<Side of the screen the settings panel sits on
+	std::chrono::nanoseconds VisualLatency {-1}; ///<Display latency to compensate for (negative: the backend's own estimate)
+	bool Calibrate = false;                      ///<Start by measuring the display latency from taps along with the flash
+	TempoMap Tempo;                              ///<Tempo automation (empty: constant BPM)
+	std::string ReportPath;                      ///<File the timing report is written to when 'p' is pressed (empty: none)
+};
+
+/** @brief Apply the command line settings to a new main window */
+template <typename Window>
+void Configure(Window &Win, RunOptions const &O) {
+	Win.Windows().SetOrientation(O.Layout);
+	Win.Windows().SetResolution(O.Resolution);
+	if (O.VisualLatency.count() >= 0) Win.Windows().SetDisplayLatency(O.VisualLatency);
+	if (!O.Tempo.Empty()) Win.SetTempoMap(O.Tempo);
+	if (O.Calibrate) Win.StartCalibration();
+	Win.SetReportFile(O.ReportPath);
+}
+
+/** @brief Run the full loop against the in-memory backend as fast as possible and report frame cost
+ * Unless it has to keep real time (to follow or send MIDI clock, or to play clicks), the run is on a manual clock
+ * that moves on one 60Hz frame per iteration, with the scripted keys of each frame delivered at its start, so
+ * every run draws the same frames: the checksum of the last screen shows whether two runs (or builds) differ.
+ */
+int RunHeadless(long long Frames, RunOptions const &O) {
+	typedef scripted_InputPipe Key;
+	constexpr std::chrono::nanoseconds FrameStep {16666667};
+	TimingThread::Options Clock = O.Clock;
+	Clock.Manual = !Clock.ClockIn && !Clock.ClockOut && !Clock.Clicks;
+	std::chrono::steady_clock::duration Elapsed;
+	unsigned long long Cells = 0, Checksum = 0;
+	{
+	MainWindow<HeadlessDrawer,scripted_InputPipe> Win(Clock);
+	Configure(Win,O);
+	Win.Input().Push({Key::Down,Key::Down,Key::Down,Key::Down,Key::Enter,Key::Frame}); //turn flashing on
+	bool Running = true;
+	auto Start = std::chrono::steady_clock::now();
+	for (long long i = 0; i < Frames && Running; i++) {
+		if (Clock.Manual) Win.Advance(Win.Now() + FrameStep);
+		Win.HandlePendingInput(Running,Win.Now());
+		ScopedTimer Iteration(Metrics().LoopTime);
+		Win.Draw();
+		Win.Refresh();
+	}
+	Elapsed = std::chrono::steady_clock::now() - Start;
+	Cells = Win.Windows().CellsOutput();
+	Checksum = Win.Windows().Checksum();
+	}
+	double Seconds = std::chrono::duration<double>(Elapsed).count();
+	std::cout << Frames << " headless frames in " << Seconds << " s (" << (double)Frames / Seconds << " frames/s), " << Cells << " cells output";
+	if (Clock.Manual) std::cout << ", last screen " << std::hex << Checksum << std::dec << " after " << (double)Frames * (double)FrameStep.count() / 1e9 << " s";
+	std::cout << '\n';
+	Metrics().Report(std::cout);
+	return 0;
+}
+
+/** @brief Run the interactive loop with a given backend until the user quits */
+template <typename WindowSystem, typename InputSystem>
+void RunInteractive(RunOptions const &O) {
+	std::chrono::nanoseconds Calibrated(-1);
+	{
+	MainWindow<WindowSystem,InputSystem> Win(O.Clock);
+	Configure(Win,O);
+	EventLoop Loop;
+	Loop.Watch(Win.Clock().TickNotifier());
+	bool Running = true;
+	while (Running) {
+		{
+		ScopedTimer Iteration(Metrics().LoopTime);
+		Win.Draw();
+		Win.Refresh();
+		}
+		//sleep until a key is pressed, the terminal is resized, a beat arrives, or the flash is due to end
+		Loop.ArmDeadline(Win.NextDeadline());
+		EventLoop::Events E = Loop.Wait();
+		Win.HandlePendingInput(Running,E.Woken);
+	}
+	if (Win.Calibration().Count() == LatencyCalibrator::Taps) Calibrated = Win.Windows().DisplayLatency();
+	}
+	if (Calibrated.count() >= 0) std::cout << "Calibrated visual latency: " << (double)Calibrated.count() / 1e6 << " ms (pass --visual-latency " << (double)Calibrated.count() / 1e6 << " to reuse it)\n";
+}
+
+int main(int argc, char** argv) {
+	RunOptions Options;
+	long long HeadlessFrames = 0;
+	bool Ansi = false;
+	std::string ClickPath;
+	std::string ClockInPath;
+	std::string ClockOutPath;
+	std::chrono::nanoseconds AudioLatency(0);
+	for (int i = 1; i < argc; i++) {
+		std::string Arg(argv[i]);
+		if (Arg == "--realtime") { //SCHED_FIFO timing thread and locked memory (needs rtprio)
+			Options.Clock.RealTime = true;
+			Options.Clock.LockMemory = true;
+		} else if (Arg == "--ansi") { //write escape sequences directly instead of going through ncurses
+			Ansi = true;
+		} else if (Arg == "--headless" && i + 1 < argc) { //benchmark without a terminal
+			char *End;
+			HeadlessFrames = std::strtoll(argv[++i],&End,10);
+			if (End == argv[i] || *End != '\0' || HeadlessFrames <= 0 || HeadlessFrames == LLONG_MAX) {
+				std::cerr << "invalid frame count: " << argv[i] << " (a positive whole number)\n";
+				return 1;
+			}
+		} else if (Arg == "--subcell" && i + 1 < argc) { //smoother visuals from half-block or Braille pixels
+			std::string Mode(argv[++i]);
+			if (Mode == "half") Options.Resolution = SubCellMode::HalfBlock;
+			else if (Mode == "braille") Options.Resolution = SubCellMode::Braille;
+		} else if (Arg == "--layout" && i + 1 < argc) { //side of the screen the settings panel sits on
+			std::string Side(argv[++i]);
+			if (Side == "south") Options.Layout = Location::South;
+			else if (Side == "east") Options.Layout = Location::East;
+			else if (Side == "west") Options.Layout = Location::West;
+		} else if (Arg == "--click" && i + 1 < argc) { //audible click into a WAV file (or a FIFO read by a player), or "null"
+			ClickPath = argv[++i];
+		} else if (Arg == "--midi-in" && i + 1 < argc) { //follow the MIDI clock from a raw MIDI device (or a FIFO)
+			ClockInPath = argv[++i];
+		} else if (Arg == "--midi-out" && i + 1 < argc) { //send MIDI clock to a raw MIDI device (or a FIFO)
+			ClockOutPath = argv[++i];
+		} else if (Arg == "--visual-latency" && i + 1 < argc) { //milliseconds from a frame being written to it being visible
+			if (!Milliseconds(argv[++i],Options.VisualLatency)) {
+				std::cerr << "invalid latency: " << argv[i] << " (milliseconds, 0 or more)\n";
+				return 1;
+			}
+		} else if (Arg == "--audio-latency" && i + 1 < argc) { //milliseconds of buffering after the click output (eg: the player)
+			if (!Milliseconds(argv[++i],AudioLatency)) {
+				std::cerr << "invalid latency: " << argv[i] << " (milliseconds, 0 or more)\n";
+				return 1;
+			}
+		} else if (Arg == "--report" && i + 1 < argc) { //file the timing report is written to when 'p' is pressed
+			Options.ReportPath = argv[++i];
+		} else if (Arg == "--calibrate") { //measure the visual latency by tapping space along with the flash
+			Options.Calibrate = true;
+		} else if (Arg == "--tempo" && i + 1 < argc) { //tempo automation, eg: 8@100,8@100-140,16@140 (bars@bpm, - linear, ~ exponential)
+			if (!Options.Tempo.Parse(argv[++i])) {
+				std::cerr << "invalid tempo map: " << argv[i] << '\n';
+				return 1;
+			}
+		} else if (Arg == "--ladder" && i + 1 < argc) { //practice ladder from:step:bars:to, eg: 100:5:4:140
+			double From, Step, Bars, To;
+			if (std::sscanf(argv[++i],"%lf:%lf:%lf:%lf",&From,&Step,&Bars,&To) != 4 || !Options.Tempo.Ladder((float)From,(float)Step,Bars,(float)To)) {
+				std::cerr << "invalid ladder: " << argv[i] << " (from:step:bars:to, with a step towards to and at most " << TempoMap::MaxSegments << " steps)\n";
+				return 1;
+			}
+		}
+	}
+	ClickEngine Clicks;
+	std::unique_ptr<AudioSink> ClickSink;
+	std::unique_ptr<AudioThread> ClickThread;
+	if (!ClickPath.empty()) {
+		try {
+			if (ClickPath == "null") ClickSink = std::make_unique<NullAudioSink>();
+			else ClickSink = std::make_unique<WavAudioSink>(ClickPath,Clicks.Rate());
+		} catch (std::exception const &E) {
+			std::cerr << E.what() << '\n';
+			return 1;
+		}
+		AudioThread::Options AudioOptions;
+		AudioOptions.RealTime = Options.Clock.RealTime;
+		Clicks.SetLatency(ClickSink->Latency() + AudioLatency);
+		ClickThread = std::make_unique<AudioThread>(Clicks,*ClickSink,AudioOptions);
+		Options.Clock.Clicks = &Clicks;
+	}
+	std::unique_ptr<MidiPort> ClockIn, ClockOut;
+	try {
+		if (!ClockInPath.empty()) ClockIn = std::make_unique<MidiPort>(ClockInPath,false);
+		if (!ClockOutPath.empty()) ClockOut = std::make_unique<MidiPort>(ClockOutPath,true);
+	} catch (std::exception const &E) {
+		std::cerr << E.what() << '\n';
+		return 1;
+	}
+	Options.Clock.ClockIn = ClockIn.get();
+	Options.Clock.ClockOut = ClockOut.get();
+	if (HeadlessFrames > 0) return RunHeadless(HeadlessFrames,Options);
+
 	{ //TODO: NCurses shouldn't be a specific requirement;
 	NCursesDrawer NCD;
 	ncurses_WindowHandle Win(11,48,NCD.GetWindowSize().Y/2-5,NCD.GetWindowSize().X/2-(48/2),' ');
@@ -23,12 +221,8 @@ int main(int, char**) {
 	}
 	}
 
-	MainWindow<NCursesDrawer,ncurses_InputPipe> Win;
-	bool Running = true;
-	while (Running) {
-		FullInput Interaction = Win.HandleInput(Running);
-		Win.Draw();
-		Win.Refresh();
-	}
+	if (Ansi) RunInteractive<AnsiDrawer,ansi_InputPipe>(Options);
+	else RunInteractive<NCursesDrawer,ncurses_InputPipe>(Options);
+	if (!Metrics().Empty()) Metrics().Report(std::cout);
 	return 0;
 }
@@ -0,0 +1,429 @@
+#ifndef DRAW_ANSI_HPP_
+#define DRAW_ANSI_HPP_
+
+/** @file ANSI Drawing Functions
+ * @brief Interface implementations that write VT/ANSI escape sequences directly, bypassing ncurses
+ */
+
+#include "CellWindow.hpp"
+#include "Interface.hpp"
+#include "Types.hpp"
+#include "Visuals.hpp"
+#include "Framebuffer.hpp"
+
+#include <array>         //array
+#include <cerrno>        //errno
+#include <csignal>       //sigaction
+#include <cstring>       //memcpy
+#include <memory>        //unique_ptr
+#include <vector>        //vector
+
+#include <sys/ioctl.h>   //TIOCGWINSZ
+#include <sys/uio.h>     //writev
+#include <termios.h>     //tcsetattr
+#include <unistd.h>      //read, write
+
+/** @brief Set by SIGWINCH; consumed by ansi_InputPipe */
+inline volatile std::sig_atomic_t &AnsiResizePending() {
+	static volatile std::sig_atomic_t Pending = 0;
+	return Pending;
+}
+
+/** @brief Preallocated output buffer that a whole frame of escape sequences is rendered into */
+struct AnsiWriter {
+private:
+	std::vector<char> m_Arena;        ///<Frame bytes (capacity only grows on resize)
+	std::size_t m_Used = 0;           ///<Bytes used in the arena
+	CellFramebuffer::Attr m_Attr = 0; ///<Attribute currently selected on the terminal
+	bool m_AttrKnown = false;         ///<Whether m_Attr reflects the terminal
+	int m_Y = -1;                     ///<Cursor row after the last write (-1 if unknown)
+	int m_X = -1;                     ///<Cursor column after the last write
+
+	/** @brief Append raw bytes */
+	void Append(const char* Bytes, std::size_t N) {
+		if (m_Used + N > m_Arena.size()) m_Arena.resize(std::max(m_Arena.size() * 2,m_Used + N));
+		std::memcpy(m_Arena.data() + m_Used,Bytes,N);
+		m_Used += N;
+	}
+	void Append(char C) {Append(&C,1);}
+	/** @brief Append an unsigned decimal number */
+	void AppendNumber(unsigned V) {
+		char Digits[10];
+		int N = 0;
+		do {Digits[N++] = (char)('0' + V % 10); V /= 10;} while (V != 0);
+		while (N > 0) Append(Digits[--N]);
+	}
+	/** @brief Append a 24-bit colour selector (38 = foreground, 48 = background) */
+	void AppendRGB(unsigned Selector, ColorType<unsigned char> C) {
+		Append(';');
+		AppendNumber(Selector);
+		Append(";2;",3);
+		AppendNumber(C.R); Append(';');
+		AppendNumber(C.G); Append(';');
+		AppendNumber(C.B);
+	}
+	/** @brief Palette used for the ncurses colour numbers (BLUE, CYAN, GREEN, YELLOW, RED, MAGENTA, BLACK, WHITE) */
+	static ColorType<unsigned char> Palette(unsigned Index) {
+		static const std::array<ColorType<unsigned char>,8> Colors {{
+			{0,90,255,255}, {0,205,205,255}, {0,205,0,255}, {230,230,0,255},
+			{220,0,0,255}, {205,0,205,255}, {0,0,0,255}, {229,229,229,255}
+		}};
+		return Colors[Index % 8];
+	}
+	/** @brief Append a UTF-8 encoded code point */
+	void AppendUTF8(uint32_t CP) {
+		char B[4];
+		if (CP < 0x80) {Append((char)CP); return;}
+		if (CP < 0x800) {B[0] = (char)(0xC0 | (CP >> 6)); B[1] = (char)(0x80 | (CP & 0x3F)); Append(B,2); return;}
+		if (CP < 0x10000) {B[0] = (char)(0xE0 | (CP >> 12)); B[1] = (char)(0x80 | ((CP >> 6) & 0x3F)); B[2] = (char)(0x80 | (CP & 0x3F)); Append(B,3); return;}
+		B[0] = (char)(0xF0 | (CP >> 18)); B[1] = (char)(0x80 | ((CP >> 12) & 0x3F)); B[2] = (char)(0x80 | ((CP >> 6) & 0x3F)); B[3] = (char)(0x80 | (CP & 0x3F));
+		Append(B,4);
+	}
+public:
+	/** @brief Make sure a full-screen repaint fits without reallocating */
+	void Reserve(BoxSize<int> Screen) {
+		std::size_t Worst = (std::size_t)Screen.X * (std::size_t)Screen.Y * 48; //glyph + a truecolor SGR per cell
+		if (m_Arena.size() < Worst) m_Arena.resize(Worst);
+	}
+
+	/** @brief Start a new frame (cursor position and attributes on the terminal are kept) */
+	void Begin() {m_Used = 0;}
+
+	/** @brief Forget the terminal state (eg: after another program wrote to it) */
+	void Forget() {m_AttrKnown = false; m_Y = -1;}
+
+	/** @brief Append a raw escape sequence */
+	void Raw(const char* Seq) {Append(Seq,std::strlen(Seq));}
+
+	/** @brief Move the cursor (zero-based), skipping the sequence when it is already there */
+	void MoveTo(int Y, int X) {
+		if (Y == m_Y && X == m_X) return;
+		Append("\x1b[",2);
+		AppendNumber((unsigned)Y + 1); Append(';');
+		AppendNumber((unsigned)X + 1); Append('H');
+		m_Y = Y;
+		m_X = X;
+	}
+
+	/** @brief Select an attribute, skipping the sequence when it is already selected */
+	void SetAttr(CellFramebuffer::Attr A) {
+		A &= ~CellAttr::LineDrawing;
+		if (m_AttrKnown && A == m_Attr) return;
+		m_Attr = A;
+		m_AttrKnown = true;
+		Append("\x1b[0",3);
+		if (A & CellAttr::Standout) Append(";7",2);
+		unsigned Pair = A & CellAttr::ColorMask;
+		if (Pair >= 2 && Pair <= 9) { //solid colour
+			AppendRGB(38,Palette(Pair - 2));
+			AppendRGB(48,Palette(Pair - 2));
+		} else if (Pair >= 12 && Pair <= 19) { //colour on black
+			AppendRGB(38,Palette(Pair - 12));
+			AppendRGB(48,Palette(6));
+		}
+		Append('m');
+	}
+
+	/** @brief Write one cell at the cursor */
+	void Put(CellFramebuffer::Glyph G, CellFramebuffer::Attr A) {
+		SetAttr(A);
+		AppendUTF8((A & CellAttr::LineDrawing) ? CellAttr::LineDrawingCodepoint(G) : G);
+		m_X += 1;
+	}
+
+	/** @brief Write N identical cells at the cursor
+	 * Runs of blanks, or of solid colour where the glyph is invisible, are erased with ECH using the
+	 * background colour instead of being spelled out, which keeps a full-screen flash to a few bytes per row.
+	 */
+	void PutRun(CellFramebuffer::Glyph G, CellFramebuffer::Attr A, int N) {
+		unsigned Pair = A & CellAttr::ColorMask;
+		bool Invisible = (G == ' ' && !(A & CellAttr::Standout)) || (Pair >= 2 && Pair <= 9 && !(A & CellAttr::LineDrawing));
+		if (N < 8 || !Invisible) {
+			for (int i = 0; i != N; i++) Put(G,A);
+			return;
+		}
+		SetAttr(A);
+		Append("\x1b[",2);
+		AppendNumber((unsigned)N);
+		Append('X'); //the cursor does not move, so the next MoveTo re-positions it
+	}
+
+	/** @brief Bytes of the current frame */
+	const char* Data() const {return m_Arena.data();}
+	/** @brief Number of bytes in the current frame */
+	std::size_t Size() const {return m_Used;}
+};
+
+/** @brief A window that lives in its own cell framebuffer at an origin on the terminal */
+struct ansi_WindowHandle final : public CellWindow<ansi_WindowHandle> {
+private:
+	CellFramebuffer m_Frame;          ///<Cell contents
+	Position<int> m_Origin;           ///<Top-left corner on the terminal
+	bool m_Active = false;            ///<Whether this is an active window
+public:
+	ansi_WindowHandle(const ansi_WindowHandle&) = delete;
+	ansi_WindowHandle& operator=(const ansi_WindowHandle&) = delete;
+
+	ansi_WindowHandle(int height, int width, int starty, int startx) {
+		m_Frame.Resize(width,height);
+		m_Frame.DrawBorder(0);
+		m_Origin = {startx,starty};
+		m_Active = true;
+	}
+	virtual ~ansi_WindowHandle() = default;
+
+	/** @brief Return whether this is "active" or "alive" */
+	virtual bool IsActive() const override {return m_Active;}
+
+	/** @brief Nothing to do: AnsiDrawer::Refresh commits every window in a single write */
+	virtual void Refresh() override {}
+
+	/** @brief Re-send the whole window on the next frame */
+	virtual void Redraw() override {m_Frame.Invalidate();}
+
+	/** @brief Cell contents of the window */
+	CellFramebuffer &Frame() {return m_Frame;}
+
+	/** @brief Append the changed cells of this window to a frame */
+	void Render(AnsiWriter &Out) {
+		Resolve();
+		m_Frame.Present([this,&Out](int Y, int X, CellFramebuffer::Glyph const *G, CellFramebuffer::Attr const *A, int N) {
+			for (int i = 0; i != N;) {
+				int Run = 1;
+				while (i + Run != N && G[i+Run] == G[i] && A[i+Run] == A[i]) Run++;
+				Out.MoveTo(m_Origin.Y + Y,m_Origin.X + X + i);
+				Out.PutRun(G[i],A[i],Run);
+				i += Run;
+			}
+		});
+	}
+
+	/** @brief Get the size of the current window */
+	virtual BoxSize<int> GetSize() override {return {m_Frame.Width(),m_Frame.Height()};}
+
+	/** @brief Resize the window */
+	virtual void resize(int Ysz, int Xsz) override {
+		m_Frame.Resize(Xsz,Ysz);
+		Repaint();
+	}
+
+	/** @brief Move the window */
+	virtual void move(int Yloc, int Xloc) override {
+		m_Origin = {Xloc,Yloc};
+		m_Frame.Invalidate();
+	}
+};
+
+/** @brief Input pipe reading raw bytes from the terminal and decoding VT key sequences */
+struct ansi_InputPipe final : public PipeInputToUI {
+	/** @brief Key codes returned by Keyboard */
+	enum Key : int {
+		NoInput = -1,   ///<Returned by Keyboard when no input is pending
+		Enter = '\n',   ///<Selection key
+		Up = 0x101,     ///<Previous field
+		Down,           ///<Next field
+		Left,           ///<Decrease field
+		Right,          ///<Increase field
+		Resize          ///<The terminal was resized
+	};
+private:
+	std::array<unsigned char,64> m_Pending; ///<Bytes read but not yet decoded
+	std::size_t m_Count = 0;                ///<Number of pending bytes
+
+	/** @brief Decode one key from the front of the pending bytes; returns the number of bytes used (0 if incomplete) */
+	std::size_t Decode(int &K) const {
+		if (m_Pending[0] != 0x1b) {
+			K = (m_Pending[0] == '\r') ? (int)Enter : (int)m_Pending[0];
+			return 1;
+		}
+		if (m_Count < 3) return 0;
+		if (m_Pending[1] != '[' && m_Pending[1] != 'O') {K = 0x1b; return 1;}
+		switch (m_Pending[2]) {
+		case 'A': K = Up; break;
+		case 'B': K = Down; break;
+		case 'C': K = Right; break;
+		case 'D': K = Left; break;
+		default: K = 0x1b; break; //unsupported sequence; drop the introducer
+		}
+		return 3;
+	}
+
+	/** @brief Read whatever bytes are waiting on stdin */
+	void Fill() {
+		if (m_Count == m_Pending.size()) return;
+		ssize_t N = ::read(STDIN_FILENO,m_Pending.data() + m_Count,m_Pending.size() - m_Count);
+		if (N > 0) m_Count += (std::size_t)N;
+	}
+public:
+	virtual int Keyboard(UserInterface &UI) override {
+		if (AnsiResizePending()) {
+			AnsiResizePending() = 0;
+			return Resize;
+		}
+		Fill();
+		if (m_Count == 0) return NoInput;
+		int Input = NoInput;
+		std::size_t Used = Decode(Input);
+		if (Used == 0) { //lone escape or split sequence; a complete sequence arrives in one read in practice
+			if (m_Count == 1) {m_Count = 0; return 0x1b;}
+			return NoInput;
+		}
+		std::memmove(m_Pending.data(),m_Pending.data() + Used,m_Count - Used);
+		m_Count -= Used;
+		if (Input == Up) {UI.MoveSelection(-1);}
+		else if (Input == Down) {UI.MoveSelection(1);}
+		else if (Input == Enter) {HandleSelectionKey(UI);}
+		else if (Input == Left) {HandleArrowKey(UI,-1);}
+		else if (Input == Right) {HandleArrowKey(UI,1);}
+		return Input;
+	}
+};
+
+/** @brief Drawer that renders each frame to ANSI/VT sequences and flushes it with a single writev */
+struct AnsiDrawer final : public WindowDrawer<ansi_WindowHandle> {
+private:
+	unsigned long long UI_Generation = 0;                                            ///<The UI generation last drawn (a mismatch means a draw needs to occur)
+	AnsiWriter m_Out;                                                                ///<Frame being rendered
+	termios m_SavedTermios;                                                          ///<Terminal settings to restore
+	struct sigaction m_SavedWinch;                                                   ///<SIGWINCH handler to restore
+	bool ForceRedraw = false;
+
+	static void OnWinch(int) {AnsiResizePending() = 1;}
+
+	/** @brief Write a buffer completely */
+	static void WriteAll(const char* Data, std::size_t N) {
+		while (N > 0) {
+			ssize_t W = ::write(STDOUT_FILENO,Data,N);
+			if (W < 0) {if (errno == EINTR) continue; return;}
+			Data += W;
+			N -= (std::size_t)W;
+		}
+	}
+	void TriggerUIRedraw() {
+		UI_Generation = 0; //older than every field
+	}
+public:
+	AnsiDrawer() {
+		::tcgetattr(STDIN_FILENO,&m_SavedTermios);
+		termios Raw = m_SavedTermios;
+		Raw.c_lflag &= ~(ICANON | ECHO);
+		Raw.c_cc[VMIN] = 0; //reads never block: input is waited on by the event loop
+		Raw.c_cc[VTIME] = 0;
+		::tcsetattr(STDIN_FILENO,TCSANOW,&Raw);
+		struct sigaction Winch {};
+		Winch.sa_handler = &AnsiDrawer::OnWinch; //no SA_RESTART, so poll() wakes up on resize
+		sigemptyset(&Winch.sa_mask);
+		::sigaction(SIGWINCH,&Winch,&m_SavedWinch);
+		WriteAll("\x1b[?1049h\x1b[?25l\x1b[2J",18); //alternate screen, hide cursor, clear
+		m_Out.Reserve(GetWindowSize());
+		SetDisplayLatency(TerminalLatency);
+	}
+
+	virtual ~AnsiDrawer() {
+		DestroyPanes();
+		WriteAll("\x1b[0m\x1b[?25h\x1b[?1049l",18);
+		::sigaction(SIGWINCH,&m_SavedWinch,nullptr);
+		::tcsetattr(STDIN_FILENO,TCSANOW,&m_SavedTermios);
+	}
+
+	/** Redraw everything on screen */
+	virtual void Redraw() override {
+		m_Out.Forget();
+		m_Out.Raw("\x1b[0m\x1b[2J"); //cleared in the same write as the repaint
+		for (auto &Window : m_Children) {
+			if (Window) Window->Redraw();
+		}
+		Refresh();
+	}
+
+	/** Render every window's changed cells, in Pane order, into the frame (flushed at CommitFrame when inside a frame) */
+	virtual void Refresh() override {
+		for (auto &Window : m_Children) {
+			if (Window) Window->Render(m_Out);
+		}
+		if (!m_InFrame) Flush();
+	}
+
+	/** Write the rendered frame with one writev */
+	virtual void Flush() override {
+		if (m_Out.Size() == 0) return;
+		//Synchronized update (DECSET 2026) makes the frame land atomically; terminals without it ignore the mode
+		static const char BeginSync[] = "\x1b[?2026h";
+		static const char EndSync[] = "\x1b[?2026l";
+		iovec Parts[3] = {
+			{(void*)BeginSync,sizeof(BeginSync) - 1},
+			{(void*)m_Out.Data(),m_Out.Size()},
+			{(void*)EndSync,sizeof(EndSync) - 1}
+		};
+		ssize_t Total = (ssize_t)(Parts[0].iov_len + Parts[1].iov_len + Parts[2].iov_len);
+		ssize_t W = ::writev(STDOUT_FILENO,Parts,3);
+		if (W >= 0 && W < Total) { //partial write (rare on a blocking tty): finish it piecewise
+			for (iovec &P : Parts) {
+				std::size_t Skip = std::min((std::size_t)W,P.iov_len);
+				W -= (ssize_t)Skip;
+				WriteAll((const char*)P.iov_base + Skip,P.iov_len - Skip);
+			}
+		}
+		m_Out.Begin();
+	}
+
+	/** Get window size */
+	virtual BoxSize<int> GetWindowSize() override {
+		winsize WS {};
+		if (::ioctl(STDOUT_FILENO,TIOCGWINSZ,&WS) < 0 || WS.ws_col == 0) return {80,24};
+		return {WS.ws_col,WS.ws_row};
+	}
+
+	/** Print the user interface in its current state */
+	virtual void PrintUI(UserInterface &UI) override {
+		if (UI.Generation() == UI_Generation && !ForceRedraw) {return;}
+		bool Repaint = (ForceRedraw || UI_Generation == 0);
+		unsigned Changed = UI.ChangedSince(UI_Generation);
+		UI_Generation = UI.Generation();
+		CellFramebuffer &tUI = Child(Pane::Input).Frame();
+		if (Repaint) {
+			tUI.Fill(' ',0);
+			tUI.DrawBorder(0);
+		}
+		int nLabels = UI.NumberOfLabels();
+		for (int i = 0; i != nLabels; i++) { //only the rows whose label or highlight changed
+			if (!Repaint && !(Changed & UserInterface::LabelMask(i))) continue;
+			tUI.FillRow(i+1,1,tUI.Width()-1,' ',0);
+			tUI.Print(i+1,1,UI.GetLabel(i),(i == UI.CurrentSelection) ? CellAttr::Standout : 0);
+		}
+	}
+
+	/** Update the visuals */
+	virtual void UpdateVisual(UserInterface const &UI) override {
+		DrawVisuals(UI,ForceRedraw);
+		ForceRedraw = false; //the UI was printed first, so both have repainted
+	}
+
+	/** Create window for handling user inputs */
+	virtual void CreateInputWindow() override {
+		CreatePane(Pane::Input);
+	}
+
+	/** Create window for output of visuals */
+	virtual void CreateVisualWindow() override {
+		CreateVisual(&CreatePane(Pane::Visual),true);
+	}
+
+	/** Process a resize event */
+	virtual void ProcessResize() override {
+		m_Out.Reserve(GetWindowSize());
+		LayoutPanes();
+		TriggerUIRedraw();
+		Redraw();
+	}
+
+	/** Implementation of local input handler */
+	virtual void HandleInput(FullInput const &Interaction) override {
+		if (Interaction.Keypress == ansi_InputPipe::Resize) {
+			ForceRedraw = true;
+			ProcessResize();
+		}
+	}
+};
+
+#endif
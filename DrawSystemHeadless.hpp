@@ -0,0 +1,249 @@
+#ifndef DRAW_HEADLESS_HPP_
+#define DRAW_HEADLESS_HPP_
+
+/** @file Headless Drawing Functions
+ * @brief Interface implementations that render into memory, so the whole loop can run without a TTY
+ */
+
+#include "CellWindow.hpp"
+#include "Interface.hpp"
+#include "Types.hpp"
+#include "Visuals.hpp"
+#include "Framebuffer.hpp"
+
+#include <deque>         //deque
+#include <initializer_list> //initializer_list
+#include <memory>        //unique_ptr
+
+/** @brief A window backed by a plain in-memory cell buffer */
+struct headless_WindowHandle final : public CellWindow<headless_WindowHandle> {
+private:
+	CellFramebuffer m_Frame;          ///<Cell contents
+	Position<int> m_Origin;           ///<Location on the (virtual) screen
+	unsigned long long m_Refreshes = 0;   ///<Number of times the window was refreshed
+	unsigned long long m_CellsOutput = 0; ///<Number of changed cells that a terminal backend would have had to write
+	bool m_Active = false;            ///<Whether this is an active window
+public:
+	headless_WindowHandle(const headless_WindowHandle&) = delete;
+	headless_WindowHandle& operator=(const headless_WindowHandle&) = delete;
+
+	headless_WindowHandle(int height, int width, int starty, int startx) {
+		m_Frame.Resize(width,height);
+		m_Origin = {startx,starty};
+		m_Boxed = false;
+		m_Active = true;
+	}
+	virtual ~headless_WindowHandle() = default;
+
+	/** @brief Return whether this is "active" or "alive" */
+	virtual bool IsActive() const override {return m_Active;}
+
+	/** @brief Refresh the window (nothing to output; the changed cells are only counted) */
+	virtual void Refresh() override {
+		m_Refreshes += 1;
+		Resolve();
+		m_CellsOutput += m_Frame.Present([](int, int, CellFramebuffer::Glyph const*, CellFramebuffer::Attr const*, int) {});
+	}
+
+	/** @brief Redraw whole window */
+	virtual void Redraw() override {
+		m_Frame.Invalidate();
+	}
+
+	/** @brief Fill the window with the background cell */
+	void Clear() {
+		Repaint();
+	}
+
+	/** @brief Cell contents of the window */
+	CellFramebuffer &Frame() {return m_Frame;}
+	/** @brief Cell contents of the window */
+	CellFramebuffer const &Frame() const {return m_Frame;}
+
+	/** @brief Print a string starting at (Y,X), clipped to the window */
+	void Print(int Y, int X, const char* Str, bool Standout = false) {
+		m_Frame.Print(Y,X,Str,Standout ? CellAttr::Standout : 0);
+	}
+
+	/** @brief Number of changed cells written out so far */
+	unsigned long long CellsOutput() const {return m_CellsOutput;}
+
+	/** @brief Number of times the window has been refreshed */
+	unsigned long long Refreshes() const {return m_Refreshes;}
+
+	/** @brief Get the size of the current window */
+	virtual BoxSize<int> GetSize() override {return {m_Frame.Width(),m_Frame.Height()};}
+
+	/** @brief Resize the window (contents are cleared) */
+	virtual void resize(int Ysz, int Xsz) override {
+		m_Frame.Resize(Xsz,Ysz);
+		Clear();
+	}
+
+	/** @brief Move the window */
+	virtual void move(int Yloc, int Xloc) override {
+		m_Origin = {Xloc,Yloc};
+	}
+};
+
+/** @brief Scripted implementation of the input pipe: replays a queue of keys */
+struct scripted_InputPipe final : public PipeInputToUI {
+	/** @brief Key codes understood by the scripted pipe */
+	enum Key : int {
+		NoInput = -1,   ///<Returned by Keyboard when the script is exhausted
+		Enter = '\n',   ///<Selection key
+		Up = 0x101,     ///<Previous field
+		Down,           ///<Next field
+		Left,           ///<Decrease field
+		Right,          ///<Increase field
+		Resize,         ///<The (virtual) screen was resized
+		Frame           ///<Ends the keys of a frame: the keys after it are delivered on the next frame
+	};
+private:
+	std::deque<int> m_Script; ///<Keys still to be delivered
+public:
+	/** @brief Queue a key */
+	void Push(int K) {m_Script.push_back(K);}
+	/** @brief Queue several keys */
+	void Push(std::initializer_list<int> Keys) {m_Script.insert(m_Script.end(),Keys);}
+	/** @brief Whether every scripted key has been delivered */
+	bool Empty() const {return m_Script.empty();}
+
+	virtual int Keyboard(UserInterface &UI) override {
+		if (m_Script.empty()) return NoInput;
+		int Input = m_Script.front();
+		m_Script.pop_front();
+		if (Input == Frame) return NoInput;
+		if (Input == Up) {UI.MoveSelection(-1);}
+		else if (Input == Down) {UI.MoveSelection(1);}
+		else if (Input == Enter) {HandleSelectionKey(UI);}
+		else if (Input == Left) {HandleArrowKey(UI,-1);}
+		else if (Input == Right) {HandleArrowKey(UI,1);}
+		return Input;
+	}
+};
+
+/** @brief Headless implementation of the drawing functions */
+struct HeadlessDrawer final : public WindowDrawer<headless_WindowHandle> {
+private:
+	unsigned long long UI_Generation = 0;                                               ///<The UI generation last drawn (a mismatch means a draw needs to occur)
+	BoxSize<int> m_ScreenSize {80,24};                                                  ///<Size of the virtual screen
+	unsigned long long m_Frames = 0;                                                    ///<Number of frames refreshed
+	bool ForceRedraw = false;
+	void TriggerUIRedraw() {
+		UI_Generation = 0; //older than every field
+	}
+public:
+	HeadlessDrawer() = default;
+	virtual ~HeadlessDrawer() = default;
+
+	/** Redraw everything on screen */
+	virtual void Redraw() override {
+		for (auto &Window : m_Children) {
+			if (Window) Window->Redraw();
+		}
+		Refresh();
+	}
+
+	/** Refresh all windows, in Pane order */
+	virtual void Refresh() override {
+		for (auto &Window : m_Children) {
+			if (Window) Window->Refresh();
+		}
+		if (!m_InFrame) Flush();
+	}
+
+	/** Count a frame as sent */
+	virtual void Flush() override {
+		m_Frames += 1;
+	}
+
+	/** Get window size */
+	virtual BoxSize<int> GetWindowSize() override {return m_ScreenSize;}
+
+	/** Print the user interface in its current state */
+	virtual void PrintUI(UserInterface &UI) override {
+		if (UI.Generation() == UI_Generation && !ForceRedraw) {return;}
+		bool Repaint = (ForceRedraw || UI_Generation == 0);
+		unsigned Changed = UI.ChangedSince(UI_Generation);
+		UI_Generation = UI.Generation();
+		headless_WindowHandle &tUI = Child(Pane::Input);
+		if (Repaint) tUI.Clear();
+		int nLabels = UI.NumberOfLabels();
+		for (int i = 0; i != nLabels; i++) { //only the rows whose label or highlight changed
+			if (!Repaint && !(Changed & UserInterface::LabelMask(i))) continue;
+			tUI.Frame().FillRow(i+1,0,tUI.Frame().Width(),' ',0);
+			tUI.Print(i+1,1,UI.GetLabel(i),i == UI.CurrentSelection);
+		}
+	}
+
+	/** Update the visuals */
+	virtual void UpdateVisual(UserInterface const &UI) override {
+		DrawVisuals(UI,ForceRedraw);
+		ForceRedraw = false; //the UI was printed first, so both have repainted
+	}
+
+	/** Create window for handling user inputs */
+	virtual void CreateInputWindow() override {
+		CreatePane(Pane::Input);
+	}
+
+	/** Create window for output of visuals */
+	virtual void CreateVisualWindow() override {
+		CreateVisual(&CreatePane(Pane::Visual),true);
+	}
+
+	/** @brief Change the size of the virtual screen (takes effect on the next Resize key) */
+	void SetWindowSize(BoxSize<int> Size) {m_ScreenSize = Size;}
+
+	/** @brief Number of frames refreshed so far */
+	unsigned long long Frames() const {return m_Frames;}
+
+	/** @brief Hash (FNV-1a) of every cell of every window, to compare the screens of two runs */
+	unsigned long long Checksum() const {
+		unsigned long long ret = 14695981039346656037ull;
+		auto Mix = [&ret](unsigned long long V) {
+			ret ^= V;
+			ret *= 1099511628211ull;
+		};
+		for (auto const &Window : m_Children) {
+			if (!Window) continue;
+			CellFramebuffer const &F = Window->Frame();
+			Mix((unsigned long long)F.Width());
+			Mix((unsigned long long)F.Height());
+			for (int Y = 0; Y != F.Height(); Y++) {
+				for (int X = 0; X != F.Width(); X++) {
+					Mix((unsigned long long)F.GlyphAt(Y,X));
+					Mix((unsigned long long)F.AttrAt(Y,X));
+				}
+			}
+		}
+		return ret;
+	}
+
+	/** @brief Number of changed cells a terminal would have received so far */
+	unsigned long long CellsOutput() const {
+		unsigned long long ret = 0;
+		for (auto const &Window : m_Children) {
+			if (Window) ret += Window->CellsOutput();
+		}
+		return ret;
+	}
+
+	/** Process a resize event */
+	virtual void ProcessResize() override {
+		LayoutPanes();
+		TriggerUIRedraw();
+		Redraw();
+	}
+
+	/** Implementation of local input handler */
+	virtual void HandleInput(FullInput const &Interaction) override {
+		if (Interaction.Keypress == scripted_InputPipe::Resize) {
+			ForceRedraw = true;
+			ProcessResize();
+		}
+	}
+};
+
+#endif
@@ -5,14 +5,18 @@
  * @brief Contains interface implementations for drawing an Ncurses interface
  */
 
+#include "CellWindow.hpp"
 #include "Interface.hpp"
 #include "Types.hpp"
 #include "Formulas.hpp"
+#include "Visuals.hpp"
+#include "Framebuffer.hpp"
 
 #include <ncurses.h>
+#include <clocale> //setlocale
 #include <string> //string
 #include <memory> //unique_ptr
-#include <unordered_map> //unordered_map
+#include <vector> //vector
 
 /** @brief Input handler for ncurses */
 struct ncurses_InputHandler : public InputHandler {
@@ -63,13 +67,48 @@ public:
 };
 
 /** @brief An ncurses window object */
-struct ncurses_WindowHandle : public WindowHandle {
+struct ncurses_WindowHandle final : public CellWindow<ncurses_WindowHandle> {
 private:
 	WINDOW* Handle;           ///<Owning pointer
-	char m_border;
 	int m_timeout = 0;        ///<Stored timeout
 	bool m_Active = false;    ///<Whether this is an active window
-	
+	CellFramebuffer m_Frame;  ///<Cell contents; only the cells that changed are written to the window
+	bool m_Framed = false;    ///<Whether the contents are managed through m_Frame (rather than raw ncurses calls)
+	std::vector<chtype> m_Span; ///<Scratch buffer for converting a changed span
+#if NCURSES_WIDECHAR
+	std::vector<cchar_t> m_WideSpan; ///<Scratch buffer for spans containing non-ASCII glyphs (eg: sub-cell blocks)
+#endif
+
+	/** @brief Convert a framebuffer cell to an ncurses character */
+	static chtype ToChtype(CellFramebuffer::Glyph G, CellFramebuffer::Attr A) {
+		chtype ret = (A & CellAttr::LineDrawing) ? NCURSES_ACS(G) : (chtype)G;
+		ret |= COLOR_PAIR(A & CellAttr::ColorMask);
+		if (A & CellAttr::Standout) ret |= A_STANDOUT;
+		return ret;
+	}
+
+	/** @brief Write the changed cells of the framebuffer into the window */
+	void Present() {
+		Resolve();
+		m_Frame.Present([this](int Y, int X, CellFramebuffer::Glyph const *G, CellFramebuffer::Attr const *A, int N) {
+#if NCURSES_WIDECHAR
+			bool Wide = false;
+			for (int i = 0; i != N; i++) Wide |= (G[i] > 0x7F);
+			if (Wide) {
+				m_WideSpan.resize((std::size_t)N);
+				for (int i = 0; i != N; i++) {
+					wchar_t WC[2] = {(wchar_t)((A[i] & CellAttr::LineDrawing) ? CellAttr::LineDrawingCodepoint(G[i]) : G[i]), L'\0'};
+					setcchar(&m_WideSpan[i],WC,(A[i] & CellAttr::Standout) ? A_STANDOUT : A_NORMAL,(short)(A[i] & CellAttr::ColorMask),nullptr);
+				}
+				mvwadd_wchnstr(Handle,Y,X,m_WideSpan.data(),N);
+				return;
+			}
+#endif
+			m_Span.resize((std::size_t)N);
+			for (int i = 0; i != N; i++) m_Span[i] = ToChtype(G[i] > 0x7F ? '#' : G[i],A[i]); //without wide-character ncurses, blocks become '#'
+			mvwaddchnstr(Handle,Y,X,m_Span.data(),N);
+		});
+	}
 public:
 	ncurses_WindowHandle(const ncurses_WindowHandle&) = delete;
 	ncurses_WindowHandle& operator=(const ncurses_WindowHandle&) = delete;
@@ -82,11 +121,12 @@ public:
 	}
 	ncurses_WindowHandle(int height, int width, int starty, int startx, char border = 0) {
 		Handle = newwin(height,width,starty,startx);
+		m_Frame.Resize(width,height);
 		box(Handle,0,0);
 		if (border != 0) {
 			wborder(Handle, border, border, border, border, border, border, border, border);
 		}
-		m_border = border;
+		m_Border = border;
 		m_Active = true;
 		wrefresh(Handle);
 	}
@@ -102,80 +142,41 @@ public:
 	/** @brief Return a handle to the window */
 	WINDOW* GetHandle() {return Handle;}
 
+	/** @brief Cell contents of the window; drawing here switches the window to diff-based output */
+	CellFramebuffer &Frame() {
+		if (!m_Framed) {
+			m_Framed = true;
+			m_Frame.Resize(GetSize().X,GetSize().Y);
+		}
+		return m_Frame;
+	}
+
 	/** @brief Refresh the window */
 	virtual void Refresh() override {
-		::wrefresh(Handle);
+		Stage();
+		::doupdate();
+	}
+
+	/** @brief Copy the window to the virtual screen without updating the terminal (see doupdate) */
+	void Stage() {
+		if (m_Framed) Present();
+		::wnoutrefresh(Handle);
 	}
 
 	/** @brief Redraw whole window */
 	virtual void Redraw() override {
 		wclear(Handle);
+		if (m_Framed) { //contents live in the framebuffer; re-send all of it
+			m_Frame.Invalidate();
+			return;
+		}
 		box(Handle,0,0);
-		if (m_border != 0) {
-			wborder(Handle, m_border, m_border, m_border, m_border, m_border, m_border, m_border, m_border);
+		if (m_Border != 0) {
+			wborder(Handle, m_Border, m_Border, m_Border, m_Border, m_Border, m_Border, m_Border, m_Border);
 		}
 		::touchwin(Handle);
 	}
 
-	/* Primitive draws */
-	virtual void DrawCircle(float Radius, Position<float> const &Loc, ColorType<unsigned char> Border, float BorderThickness, bool Fill = false, ColorType<unsigned char> FillColor = {0,0,0,0}) override {
-		Unused(Radius, Loc, Border, BorderThickness, Fill, FillColor);
-		throw std::runtime_error("Not Implemented");
-	}
-	virtual void DrawTriangle(Position<float> const &Pt1, Position<float> const &Pt2, Position<float> const &Pt3, ColorType<unsigned char> Border, float BorderThickness, Position<float> const &Offset = {0,0}, bool Fill = false, ColorType<unsigned char> FillColor = {0,0,0,0}) override {
-		Unused(Pt1, Pt2, Pt3, Border, BorderThickness, Offset, Fill, FillColor);
-		throw std::runtime_error("Not Implemented");
-	}
-	virtual void DrawLine(Position<float> const &Pt1, Position<float> const &Pt2, float Thickness, Position<float> const &Offset = {0,0}) override {
-		Unused(Pt1, Pt2, Thickness, Offset);
-		throw std::runtime_error("Not Implemented");
-	}
-
-	/** Fill will be determined the following way:
-	 * R G B channels will be used to determine colour pair, as colour pairs will be limited:
-	 * R=2: BLUE
-	 * R=3: TEAL
-	 * R=4: GREEN
-	 * R=5: ORANGE
-	 * R=6: RED
-	 * R=7: PURPLE
-	 * R=8: BLACK
-	 * R=9: WHITE
-	 * A channel will determine whether a character is also printed to screen.  The A channel will print based on the following:
-	 * A < 25:  print '`'
-	 * A < 50:  print '"'
-	 * A < 75:  print '-'
-	 * A < 100: print '~'
-	 * A < 125: print ':'
-	 * A < 150: print '*'
-	 * A < 175: print '+'
-	 * A < 200: print '%'
-	 * A < 225: print 'O'
-	 * A < 250: print '8'
-	 * A = 255: '#' and fills entire block;
-	 */
-	virtual void FillScreen(ColorType<unsigned char> FillColor) override {
-		if (FillColor.A == 255) {
-			if (FillColor.R > 10) FillColor.R -= 10;
-			wbkgd(Handle,COLOR_PAIR(FillColor.R) | '#');
-			return;
-		} else {
-			if (FillColor.R < 10) FillColor.R += 10;
-		}
-		if      (FillColor.A > 250) wbkgd(Handle,COLOR_PAIR(FillColor.R) | '#');
-		else if (FillColor.A > 225) wbkgd(Handle,COLOR_PAIR(FillColor.R) | '8');
-		else if (FillColor.A > 200) wbkgd(Handle,COLOR_PAIR(FillColor.R) | 'O');
-		else if (FillColor.A > 175) wbkgd(Handle,COLOR_PAIR(FillColor.R) | '%');
-		else if (FillColor.A > 150) wbkgd(Handle,COLOR_PAIR(FillColor.R) | '+');
-		else if (FillColor.A > 125) wbkgd(Handle,COLOR_PAIR(FillColor.R) | '*');
-		else if (FillColor.A > 100) wbkgd(Handle,COLOR_PAIR(FillColor.R) | ':');
-		else if (FillColor.A > 75 ) wbkgd(Handle,COLOR_PAIR(FillColor.R) | '~');
-		else if (FillColor.A > 50 ) wbkgd(Handle,COLOR_PAIR(FillColor.R) | '-');
-		else if (FillColor.A > 25 ) wbkgd(Handle,COLOR_PAIR(FillColor.R) | '"');
-		else if (FillColor.A > 0  ) wbkgd(Handle,COLOR_PAIR(FillColor.R) | '`');
-		else wbkgd(Handle,' ');
-	}
-
 	/** @brief Draw a character 
 	 * @param Y     Y-location to draw the character
 	 * @param X     X-location to draw the character
@@ -206,6 +207,10 @@ public:
 	/** @brief Resize the window */
 	void resize(int Ysz, int Xsz) {
 		::wresize(Handle,Ysz,Xsz);
+		if (m_Framed) {
+			m_Frame.Resize(Xsz,Ysz);
+			Repaint();
+		}
 	}
 
 	/** @brief Move the window */
@@ -214,76 +219,11 @@ public:
 	}
 };
 
-/** @brief NCurses implementation of VisualOutput */
-struct NCursesVisual : public VisualOutput {
-private:
-	std::size_t UI_Hash = 0;
-	bool FlashState = false; ///<The flashing state
-	/** @brief Sets the flash state on the screen */
-	void SetFlashState(bool State, UserInterface const &UI) {
-		FlashState = State;
-		if (has_colors()) {
-			if (State) Win->FillScreen({(unsigned char)(UI.Color+2),0,0,255});
-			else       Win->FillScreen({0,0,0,0}); //FIXME: this should be 2; why does only 1 work?
-		} else {
-			if (State) Win->FillScreen({1,0,0,255});
-			else       Win->FillScreen({0,0,0,0});
-		}
-	}
-	/** @brief Reset the flash timer */
-	void reset() {
-		FirstTick = std::chrono::steady_clock::now();
-		FlashCounter = 1;
-	}
-	void TriggerUIRedraw() {
-		UI_Hash -= 1;
-	}
-public:
-	NCursesVisual(WindowHandle* W) {
-		Win = W;
-		FirstTick = std::chrono::steady_clock::now();
-		LastTick = FirstTick;
-		TickTimer = FirstTick;
-	}
-	virtual ~NCursesVisual() = default;
-
-	/** @brief Draw a flash on the screen */
-	virtual void DrawFlash(UserInterface const &UI) override { //FIXME: very sloppy for now; Definitely need to fix how we output to the window;
-		if (UI.hash() != UI_Hash) { //Avoid locking the output
-			UI_Hash = UI.hash();
-			reset();
-		} else if (!UI.Flashing) {
-			reset();
-		}
-		typedef std::chrono::milliseconds milliseconds;
-		milliseconds Diff = std::chrono::duration_cast<milliseconds>(std::chrono::steady_clock::now() - FirstTick);
-		milliseconds DiffTick = std::chrono::duration_cast<milliseconds>(std::chrono::steady_clock::now() - TickTimer);
-		long unsigned MillisPerBeat = ComputeMillisecondsPerBeat(UI.BPM);
-		long unsigned local_FlashInterval = std::max(std::min(FlashInterval,(long long)MillisPerBeat / 6),(long long)24);
-		if ((long unsigned)DiffTick.count() > (long unsigned)(local_FlashInterval)) {
-			SetFlashState(false,UI);
-		}
-		if ((long unsigned)Diff.count() > MillisPerBeat * FlashCounter) {
-			SetFlashState(true,UI);
-			LastTick = std::chrono::steady_clock::now();
-			TickTimer = LastTick;
-			FlashCounter += 1;
-		}
-	}
-	virtual void DrawMetronome(UserInterface const &UI) override { Unused(UI);};
-	virtual void DrawRaindrops(UserInterface const &UI) override { Unused(UI);};
-	virtual void ForceRedraw() override {
-		TriggerUIRedraw();
-		Win->Redraw();
-	}
-};
-
 /** @brief NCurses implementation of the drawing functions */
-struct NCursesDrawer : public Drawer {
+struct NCursesDrawer final : public WindowDrawer<ncurses_WindowHandle> {
 private:
-	std::size_t UI_Hash = 0;                                                           ///<The UI hash used to determine whether a draw needs to occur
+	unsigned long long UI_Generation = 0;                                              ///<The UI generation last drawn (a mismatch means a draw needs to occur)
 	std::unique_ptr<ncurses_InputHandler> m_Input;                                     ///<Owning pointer for the input handler
-	std::unordered_map<std::string,std::unique_ptr<ncurses_WindowHandle>> m_Children;  ///<A map of window handles
 	bool ForceRedraw = false;
 	/** Set NCurses color pairs */
 	void SetColorPairs() {
@@ -306,10 +246,11 @@ private:
 		init_pair(19,COLOR_WHITE,COLOR_BLACK);
 	}
 	void TriggerUIRedraw() {
-		UI_Hash -= 1;
+		UI_Generation = 0; //older than every field
 	}
 public:
 	NCursesDrawer() {
+		std::setlocale(LC_ALL,""); //UTF-8 output for sub-cell glyphs
 		initscr();
 		noraw();
 		echo();
@@ -317,32 +258,38 @@ public:
 		curs_set(0);
 		noqiflush();
 		keypad(stdscr,true);
-		timeout(2);
+		timeout(0); //input is waited on by the event loop
 		SetColorPairs();
+		SetDisplayLatency(TerminalLatency);
 		Refresh();
 		m_Input = std::make_unique<ncurses_InputHandler>(ncurses_InputHandler(stdscr));
 	}
 
 	virtual ~NCursesDrawer() {
-		m_Children.clear();
+		DestroyPanes();
 		endwin();
 	}
 
 	/** Redraw everything on screen */
 	virtual void Redraw() override {
 		for (auto &Window : m_Children) {
-			Window.second->Redraw();
-			Window.second->Refresh();
+			if (Window) Window->Redraw();
 		}
 		Refresh();
 	}
 
-	/** Refresh all windows */
+	/** Stage every window, in Pane order, and update the terminal once (at CommitFrame when inside a frame) */
 	virtual void Refresh() override {
+		::wnoutrefresh(stdscr);
 		for (auto &Window : m_Children) {
-			Window.second->Refresh();
+			if (Window) Window->Stage();
 		}
-		::refresh();
+		if (!m_InFrame) Flush();
+	}
+
+	/** Write the staged windows to the terminal */
+	virtual void Flush() override {
+		::doupdate();
 	}
 
 	/** Get window size */
@@ -354,122 +301,60 @@ public:
 
 	/** Print the user interface in its current state */
 	virtual void PrintUI(UserInterface &UI) override {
-		std::size_t NewUI = UI.hash();
-		if (NewUI == UI_Hash && !ForceRedraw) {return;}
-		else {UI_Hash = NewUI;}
-		WINDOW* tUI = m_Children["InputWindow"]->GetHandle();
-		wclear(tUI);
-		box(tUI,0,0);
+		if (UI.Generation() == UI_Generation && !ForceRedraw) {return;}
+		bool Repaint = (ForceRedraw || UI_Generation == 0);
+		unsigned Changed = UI.ChangedSince(UI_Generation);
+		UI_Generation = UI.Generation();
+		CellFramebuffer &tUI = Child(Pane::Input).Frame(); //only the characters that changed reach the terminal
+		if (Repaint) {
+			tUI.Fill(' ',0);
+			tUI.DrawBorder(0);
+		}
 		int nLabels = UI.NumberOfLabels();
-		for (int i = 0; i != nLabels; i++) {
-			if (i == UI.CurrentSelection) {wattrset(tUI,A_STANDOUT);}
-			mvwprintw(tUI,i+1,1,"%s",UI.GetLabel(i).c_str());
-			wattrset(tUI,A_NORMAL);
-			wprintw(tUI,"      ");
+		for (int i = 0; i != nLabels; i++) { //only the rows whose label or highlight changed
+			if (!Repaint && !(Changed & UserInterface::LabelMask(i))) continue;
+			tUI.FillRow(i+1,1,tUI.Width()-1,' ',0);
+			tUI.Print(i+1,1,UI.GetLabel(i),(i == UI.CurrentSelection) ? CellAttr::Standout : 0);
 		}
 	}
 	
 	/** Update the visuals */
 	virtual void UpdateVisual(UserInterface const &UI) override {
-		if (ForceRedraw) {
-			m_VOut->ForceRedraw();
-		}
-		if (!m_VOut) return;
-		m_VOut->DrawFlash(UI);
-		m_VOut->DrawMetronome(UI);
-		m_VOut->DrawRaindrops(UI);
+		DrawVisuals(UI,ForceRedraw);
+		ForceRedraw = false; //the UI was printed first, so both have repainted
 	}
 
 	/** Create window for handling user inputs */
 	virtual void CreateInputWindow() override {
-		BoxSize<int> WinSize = GetWindowSize();
-		switch (Orientation) {
-		case Location::North: { //create box on top 7 pixels
-			m_Children.emplace("InputWindow",std::make_unique<ncurses_WindowHandle>(7,WinSize.X,0,0));
-			break;
-		}
-		//case Location::South: //create box on bottom 7 pixels
-		//case Location::East:  //create east
-		//case Location::West: //create west
-		default: return;
-		}
+		CreatePane(Pane::Input);
 	}
 
 	/** Create window for output of visuals */
-	virtual void CreateVisualWindow() override { //TODO: check if window is oriented the same as the window manager;
-		BoxSize<int> WinSize = GetWindowSize();
-		switch (Orientation) {
-		case Location::North: { //create box on top 7 pixels
-			m_Children.emplace("VisualWindow",std::make_unique<ncurses_WindowHandle>(WinSize.Y-7,WinSize.X,7,0));
-			break;
-		}
-		//case Location::South: //create box on bottom 7 pixels
-		//case Location::East:  //create east
-		//case Location::West: //create west
-		default: return;
-		}
-		m_VOut = std::make_unique<NCursesVisual>(NCursesVisual(m_Children["VisualWindow"].get()));
+	virtual void CreateVisualWindow() override {
+		CreateVisual(&CreatePane(Pane::Visual),has_colors());
 	}
 
 	/** Process a resize event */
-	void ProcessResize() {
-		BoxSize<int> const WinSize = GetWindowSize();
-		switch (Orientation) {
-		case Location::North: {
-			m_Children.at("InputWindow")->resize(7,WinSize.X);
-			m_Children.at("VisualWindow")->resize(WinSize.Y-7,WinSize.X);
-			break;
-		}
-		}
+	virtual void ProcessResize() override {
+		LayoutPanes();
 		TriggerUIRedraw();
 		Redraw();
 	}
 
 	/** Implementation of local input handler */
 	void HandleInput(FullInput const &Interaction) {
-		ForceRedraw = false;
 		if (Interaction.Keypress == KEY_RESIZE) {
 			ForceRedraw = true;
+			BeginFrame();
 			ProcessResize();
-			Refresh();
+			CommitFrame();
 		}
 	}
 };
 
 /** @brief NCurses implementation of the input pipe */
-struct ncurses_InputPipe : public PipeInputToUI {
-private:
-	/** @brief Handle the user "selection" key */
-	void HandleSelectionKey(UserInterface &UI) {
-		switch ((UserInterface::Selection)(UI.CurrentSelection)) {
-		case UserInterface::Selection::TIMESIGNATURE: break;                  //need to create window
-		case UserInterface::Selection::BEATSPERMIN: break;                    //need to create window
-		case UserInterface::Selection::COLORSEL: break;                       //Not applicable
-		case UserInterface::Selection::VISUALIZATION: break;                  //Not applicable
-		case UserInterface::Selection::FLASHING: UI.ToggleFlashing(); break;
-		default: break;
-		}
-	}
-
-	/** @brief Handle the user's keyboard arrow key input */
-	void HandleArrowKey(UserInterface &UI, char Direction) {
-		switch ((UserInterface::Selection)(UI.CurrentSelection)) {
-		case UserInterface::Selection::TIMESIGNATURE: break; //N/A
-		case UserInterface::Selection::BEATSPERMIN:   //Increment BPM
-			UI.BPM += (Direction > 0) - (UI.BPM > 1.0f && Direction < 0); 
-			break;
-		case UserInterface::Selection::COLORSEL:      //Increment color
-			UI.SetColor((Direction > 0) - (Direction < 0));
-			break;
-		case UserInterface::Selection::VISUALIZATION: //Increment visualization
-			UI.SetVisualization(Direction);
-			break;
-		case UserInterface::Selection::FLASHING:      //Increment flashing
-			UI.ToggleFlashing(); 
-			break;
-		default: break;
-		}
-	}
+struct ncurses_InputPipe final : public PipeInputToUI {
+	static constexpr int NoInput = ERR; ///<Returned by Keyboard when no input is pending
 public:
 	virtual int Keyboard(UserInterface &UI) override {
 		int Input = getch();
@@ -0,0 +1,129 @@
+#ifndef EVENT_LOOP_HPP_
+#define EVENT_LOOP_HPP_
+
+/** @file Event loop
+ * @brief Sleeps until either input arrives or the next visual change is due
+ */
+
+#include "BeatScheduler.hpp" //ToTimespec
+
+#include <chrono>    //std::chrono
+#include <cerrno>    //errno
+#include <cstdint>   //uint64_t
+#include <stdexcept> //exceptions
+
+#include <poll.h>        //poll
+#include <sys/eventfd.h> //eventfd
+#include <sys/timerfd.h> //timerfd_create
+#include <unistd.h>      //read, close
+
+/** @brief Cross-thread wake-up signal backed by an eventfd */
+struct EventNotifier {
+private:
+	int m_FD = -1; ///<Owning eventfd descriptor
+public:
+	EventNotifier(const EventNotifier&) = delete;
+	EventNotifier& operator=(const EventNotifier&) = delete;
+
+	EventNotifier() {
+		m_FD = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if (m_FD < 0) throw std::runtime_error("eventfd failed");
+	}
+	~EventNotifier() {
+		if (m_FD >= 0) close(m_FD);
+	}
+
+	/** @brief Descriptor that becomes readable once Notify has been called */
+	int FD() const {return m_FD;}
+
+	/** @brief Wake whoever is polling FD() (async-signal and real-time safe) */
+	void Notify() {
+		uint64_t One = 1;
+		if (::write(m_FD, &One, sizeof(One)) < 0) {} //a saturated counter is still readable
+	}
+
+	/** @brief Consume all pending notifications */
+	void Drain() {
+		uint64_t Count;
+		if (::read(m_FD, &Count, sizeof(Count)) < 0) {} //EAGAIN: nothing pending
+	}
+};
+
+/** @brief Blocks on an input file descriptor and a deadline timer */
+struct EventLoop {
+	using Clock = std::chrono::steady_clock;
+	using TimePoint = Clock::time_point;
+
+	/** @brief What woke the loop up */
+	struct Events {
+		bool Input = false;     ///<Input is ready to be read
+		bool Deadline = false;  ///<The armed deadline has passed
+		bool Interrupted = false; ///<Woken by a signal (eg: SIGWINCH)
+		bool Notified = false;  ///<The watched notifier fired (or watched descriptor became readable)
+		TimePoint Woken;        ///<When poll returned: the closest time to input arriving (eg: for timing taps)
+	};
+private:
+	int m_InputFD;        ///<Non-owning input descriptor
+	int m_TimerFD = -1;   ///<Owning timerfd descriptor
+	int m_NotifyFD = -1;  ///<Non-owning notifier descriptor (negative if unused)
+	TimePoint m_Armed = TimePoint::max(); ///<Currently armed deadline
+public:
+	EventLoop(const EventLoop&) = delete;
+	EventLoop& operator=(const EventLoop&) = delete;
+
+	/** @param InputFD   Descriptor to watch for input (normally STDIN_FILENO) */
+	EventLoop(int InputFD = STDIN_FILENO) : m_InputFD(InputFD) {
+		m_TimerFD = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+		if (m_TimerFD < 0) throw std::runtime_error("timerfd_create failed");
+	}
+	~EventLoop() {
+		if (m_TimerFD >= 0) close(m_TimerFD);
+	}
+
+	/** @brief Arm the timer for an absolute deadline (TimePoint::max() disarms it) */
+	void ArmDeadline(TimePoint Deadline) {
+		if (Deadline == m_Armed) return;
+		m_Armed = Deadline;
+		itimerspec Spec {};
+		if (Deadline != TimePoint::max()) Spec.it_value = ToTimespec(Deadline);
+		timerfd_settime(m_TimerFD, TFD_TIMER_ABSTIME, &Spec, nullptr);
+	}
+
+	/** @brief Additionally wake up when a notifier (eg: another thread) fires */
+	void Watch(EventNotifier const &Notifier) {
+		m_NotifyFD = Notifier.FD();
+	}
+
+	/** @brief Additionally wake up when a descriptor (eg: a MIDI port) becomes readable; negative stops watching */
+	void Watch(int FD) {
+		m_NotifyFD = FD;
+	}
+
+	/** @brief Sleep until input is available, the deadline passes, a notifier fires, or a signal arrives */
+	Events Wait() {
+		Events ret;
+		pollfd FDs[3] = {
+			{m_InputFD, POLLIN, 0},
+			{m_TimerFD, POLLIN, 0},
+			{m_NotifyFD, POLLIN, 0} //poll ignores negative descriptors
+		};
+		int Ready = ::poll(FDs, 3, -1);
+		ret.Woken = Clock::now();
+		if (Ready < 0) {
+			if (errno == EINTR) {ret.Interrupted = true; return ret;}
+			throw std::runtime_error("poll failed");
+		}
+		ret.Input = FDs[0].revents & (POLLIN | POLLHUP | POLLERR);
+		ret.Notified = FDs[2].revents & (POLLIN | POLLHUP | POLLERR);
+		if (FDs[1].revents & POLLIN) {
+			uint64_t Expirations;
+			if (::read(m_TimerFD, &Expirations, sizeof(Expirations)) == sizeof(Expirations)) {
+				ret.Deadline = true;
+				m_Armed = TimePoint::max(); //one-shot; must be re-armed
+			}
+		}
+		return ret;
+	}
+};
+
+#endif
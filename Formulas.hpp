@@ -10,4 +10,11 @@ FloatType ComputeMillisecondsPerBeat(FloatType BPM) {
 	return (1000.0 * 60.0 / BPM);
 }
 
+/** @brief Compute the (fractional) number of nanoseconds per beat based on beats per minute */
+template <typename FloatType>
+FloatType ComputeNanosecondsPerBeat(FloatType BPM) {
+	static_assert(std::is_floating_point<FloatType>::value);
+	return (1000000000.0 * 60.0 / BPM);
+}
+
 #endif
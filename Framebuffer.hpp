@@ -0,0 +1,244 @@
+#ifndef FRAMEBUFFER_HPP_
+#define FRAMEBUFFER_HPP_
+
+/** @file Cell framebuffer
+ * @brief Double-buffered character-cell framebuffer that only reports the cells that changed
+ */
+
+#include <algorithm> //fill, copy
+#include <cstddef>   //size_t
+#include <cstdint>   //uint32_t
+#include <cstring>   //memcmp
+#include <vector>    //vector
+
+/** @brief Backend-independent cell attributes */
+struct CellAttr {
+	static constexpr uint32_t ColorMask = 0xFF;      ///<Colour pair (same numbering as the ncurses backend)
+	static constexpr uint32_t Standout = 1u << 8;    ///<Highlighted (reverse video) text
+	static constexpr uint32_t LineDrawing = 1u << 9; ///<Glyph is a VT100 line-drawing character ('q','x','l','k','m','j')
+
+	/** @brief Unicode box-drawing code point for a VT100 line-drawing glyph */
+	static constexpr uint32_t LineDrawingCodepoint(uint32_t G) {
+		switch (G) {
+		case 'q': return 0x2500; //─
+		case 'x': return 0x2502; //│
+		case 'l': return 0x250C; //┌
+		case 'k': return 0x2510; //┐
+		case 'm': return 0x2514; //└
+		case 'j': return 0x2518; //┘
+		default: return G;
+		}
+	}
+};
+
+/** @brief A captured set of cells stored as horizontal runs, so it can be blitted (or erased) without touching the rest of a buffer */
+struct CellSprite {
+	/** @brief Cells [X,X+Count) of row Y, stored from Offset in Glyphs/Attrs */
+	struct Run {
+		int Y;
+		int X;
+		int Count;
+		std::size_t Offset;
+	};
+	std::vector<Run> Runs;
+	std::vector<uint32_t> Glyphs;
+	std::vector<uint32_t> Attrs;
+
+	void Clear() {
+		Runs.clear();
+		Glyphs.clear();
+		Attrs.clear();
+	}
+};
+
+/** @brief Front/back cell buffers with a row-by-row diff
+ * Drawing goes into the back buffer.  Present() compares it against the front buffer (what the
+ * terminal is known to show), reports only the spans that changed and then brings the front buffer
+ * up to date.  Glyphs and attributes are kept in separate contiguous arrays so that unchanged rows are
+ * rejected with a memcmp and changed rows are scanned a block at a time with vectorizable compares.
+ */
+struct CellFramebuffer {
+	using Glyph = uint32_t;
+	using Attr = uint32_t;
+private:
+	static constexpr Glyph Unknown = 0xFFFFFFFF; ///<Front-buffer value for cells whose on-screen state is unknown
+	static constexpr int Block = 8;              ///<Cells compared per vector step
+	static constexpr int MergeGap = 4;           ///<Unchanged gaps shorter than this are re-sent rather than skipped (a cursor move costs more)
+
+	int m_Width = 0;
+	int m_Height = 0;
+	std::vector<Glyph> m_BackGlyph;  ///<Glyphs being drawn
+	std::vector<Attr> m_BackAttr;    ///<Attributes being drawn
+	std::vector<Glyph> m_FrontGlyph; ///<Glyphs on screen
+	std::vector<Attr> m_FrontAttr;   ///<Attributes on screen
+
+	std::size_t Index(int Y, int X) const {return (std::size_t)Y * (std::size_t)m_Width + (std::size_t)X;}
+
+	/** @brief First cell in [Begin,End) of a row that differs, or End */
+	int FirstChange(std::size_t Row, int Begin, int End) const {
+		Glyph const *BG = &m_BackGlyph[Row], *FG = &m_FrontGlyph[Row];
+		Attr const *BA = &m_BackAttr[Row], *FA = &m_FrontAttr[Row];
+		int X = Begin;
+		for (; X + Block <= End; X += Block) {
+			uint32_t Acc = 0;
+			for (int i = 0; i != Block; i++) Acc |= (BG[X+i] ^ FG[X+i]) | (BA[X+i] ^ FA[X+i]); //branch-free: vectorizes
+			if (Acc) break;
+		}
+		for (; X < End; X++) {
+			if (BG[X] != FG[X] || BA[X] != FA[X]) return X;
+		}
+		return End;
+	}
+
+	/** @brief First cell in [Begin,End) of a row that is unchanged, or End */
+	int FirstSame(std::size_t Row, int Begin, int End) const {
+		for (int X = Begin; X < End; X++) {
+			if (m_BackGlyph[Row+X] == m_FrontGlyph[Row+X] && m_BackAttr[Row+X] == m_FrontAttr[Row+X]) return X;
+		}
+		return End;
+	}
+public:
+	CellFramebuffer() = default;
+	CellFramebuffer(int Width, int Height) {Resize(Width,Height);}
+
+	/** @brief Resize both buffers; the back buffer is blanked and the whole screen will be re-sent */
+	void Resize(int Width, int Height) {
+		m_Width = std::max(Width,0);
+		m_Height = std::max(Height,0);
+		std::size_t N = (std::size_t)m_Width * (std::size_t)m_Height;
+		m_BackGlyph.assign(N,' ');
+		m_BackAttr.assign(N,0);
+		m_FrontGlyph.assign(N,Unknown);
+		m_FrontAttr.assign(N,0);
+	}
+
+	int Width() const {return m_Width;}
+	int Height() const {return m_Height;}
+
+	/** @brief Forget what is on screen so the next Present() re-sends every cell (eg: after a terminal clear) */
+	void Invalidate() {
+		std::fill(m_FrontGlyph.begin(),m_FrontGlyph.end(),Unknown);
+	}
+
+	/** @brief Set one cell (ignored outside the buffer) */
+	void Set(int Y, int X, Glyph G, Attr A) {
+		if (Y < 0 || X < 0 || Y >= m_Height || X >= m_Width) return;
+		m_BackGlyph[Index(Y,X)] = G;
+		m_BackAttr[Index(Y,X)] = A;
+	}
+
+	/** @brief Glyph in the back buffer */
+	Glyph GlyphAt(int Y, int X) const {return m_BackGlyph[Index(Y,X)];}
+	/** @brief Attribute in the back buffer */
+	Attr AttrAt(int Y, int X) const {return m_BackAttr[Index(Y,X)];}
+
+	/** @brief Fill a horizontal run [X0,X1) of row Y (clipped) */
+	void FillRow(int Y, int X0, int X1, Glyph G, Attr A) {
+		if (Y < 0 || Y >= m_Height) return;
+		X0 = std::max(X0,0);
+		X1 = std::min(X1,m_Width);
+		if (X0 >= X1) return;
+		std::fill(m_BackGlyph.begin() + Index(Y,X0),m_BackGlyph.begin() + Index(Y,X1),G);
+		std::fill(m_BackAttr.begin() + Index(Y,X0),m_BackAttr.begin() + Index(Y,X1),A);
+	}
+
+	/** @brief Fill the rectangle [Y0,Y1) x [X0,X1) (clipped) */
+	void FillRect(int Y0, int X0, int Y1, int X1, Glyph G, Attr A) {
+		for (int Y = std::max(Y0,0); Y < std::min(Y1,m_Height); Y++) FillRow(Y,X0,X1,G,A);
+	}
+
+	/** @brief Fill the whole back buffer */
+	void Fill(Glyph G, Attr A) {
+		std::fill(m_BackGlyph.begin(),m_BackGlyph.end(),G);
+		std::fill(m_BackAttr.begin(),m_BackAttr.end(),A);
+	}
+
+	/** @brief Print a string starting at (Y,X), clipped to the buffer */
+	void Print(int Y, int X, const char* Str, Attr A = 0) {
+		for (; *Str != '\0' && X < m_Width; Str++, X++) Set(Y,X,(unsigned char)*Str,A);
+	}
+
+	/** @brief Draw a box around the edge of the buffer; Border of 0 uses line-drawing characters */
+	void DrawBorder(Attr A, char Border = 0) {
+		if (m_Width < 2 || m_Height < 2) return;
+		Attr LA = Border ? A : (A | CellAttr::LineDrawing);
+		auto G = [Border](char LineChar) {return (Glyph)(unsigned char)(Border ? Border : LineChar);};
+		FillRow(0,1,m_Width-1,G('q'),LA);
+		FillRow(m_Height-1,1,m_Width-1,G('q'),LA);
+		for (int Y = 1; Y < m_Height-1; Y++) {
+			Set(Y,0,G('x'),LA);
+			Set(Y,m_Width-1,G('x'),LA);
+		}
+		Set(0,0,G('l'),LA);
+		Set(0,m_Width-1,G('k'),LA);
+		Set(m_Height-1,0,G('m'),LA);
+		Set(m_Height-1,m_Width-1,G('j'),LA);
+	}
+
+	/** @brief Capture the cells of [Y0,Y1) x [X0,X1) that differ from a background cell */
+	void Capture(CellSprite &S, Glyph BackgroundGlyph, Attr BackgroundAttr, int Y0, int X0, int Y1, int X1) const {
+		S.Clear();
+		X0 = std::max(X0,0);
+		X1 = std::min(X1,m_Width);
+		for (int Y = std::max(Y0,0); Y < std::min(Y1,m_Height); Y++) {
+			std::size_t Row = Index(Y,0);
+			for (int X = X0; X < X1;) {
+				if (m_BackGlyph[Row+X] == BackgroundGlyph && m_BackAttr[Row+X] == BackgroundAttr) {X++; continue;}
+				int End = X;
+				while (End < X1 && (m_BackGlyph[Row+End] != BackgroundGlyph || m_BackAttr[Row+End] != BackgroundAttr)) End++;
+				S.Runs.push_back({Y,X,End - X,S.Glyphs.size()});
+				S.Glyphs.insert(S.Glyphs.end(),m_BackGlyph.begin() + Row + X,m_BackGlyph.begin() + Row + End);
+				S.Attrs.insert(S.Attrs.end(),m_BackAttr.begin() + Row + X,m_BackAttr.begin() + Row + End);
+				X = End;
+			}
+		}
+	}
+
+	/** @brief Copy a sprite into the back buffer (clipped) */
+	void Blit(CellSprite const &S) {
+		for (CellSprite::Run const &R : S.Runs) {
+			if (R.Y < 0 || R.Y >= m_Height) continue;
+			int X0 = std::max(R.X,0), X1 = std::min(R.X + R.Count,m_Width);
+			if (X0 >= X1) continue;
+			std::copy(S.Glyphs.begin() + R.Offset + (X0 - R.X),S.Glyphs.begin() + R.Offset + (X1 - R.X),m_BackGlyph.begin() + Index(R.Y,X0));
+			std::copy(S.Attrs.begin() + R.Offset + (X0 - R.X),S.Attrs.begin() + R.Offset + (X1 - R.X),m_BackAttr.begin() + Index(R.Y,X0));
+		}
+	}
+
+	/** @brief Fill the cells covered by a sprite (eg: to erase it with the background) */
+	void FillSprite(CellSprite const &S, Glyph G, Attr A) {
+		for (CellSprite::Run const &R : S.Runs) FillRow(R.Y,R.X,R.X + R.Count,G,A);
+	}
+
+	/** @brief Report every changed span and make the front buffer match the back buffer
+	 * @param Emit  Called as Emit(Row, Column, Glyphs, Attrs, Count) for each run of cells to output
+	 * @return Number of cells emitted
+	 */
+	template <typename EmitFunction>
+	std::size_t Present(EmitFunction &&Emit) {
+		std::size_t Emitted = 0;
+		if (m_Width == 0 || m_Height == 0) return Emitted; //a collapsed window has no cells to index
+		for (int Y = 0; Y != m_Height; Y++) {
+			std::size_t Row = Index(Y,0);
+			if (std::memcmp(&m_BackGlyph[Row],&m_FrontGlyph[Row],sizeof(Glyph) * (std::size_t)m_Width) == 0 &&
+			    std::memcmp(&m_BackAttr[Row],&m_FrontAttr[Row],sizeof(Attr) * (std::size_t)m_Width) == 0) continue;
+			int X = FirstChange(Row,0,m_Width);
+			while (X < m_Width) {
+				int End = FirstSame(Row,X,m_Width);
+				int Next = FirstChange(Row,End,m_Width);
+				while (Next < m_Width && Next - End < MergeGap) { //absorb short unchanged gaps
+					End = FirstSame(Row,Next,m_Width);
+					Next = FirstChange(Row,End,m_Width);
+				}
+				Emit(Y,X,&m_BackGlyph[Row+X],&m_BackAttr[Row+X],End - X);
+				Emitted += (std::size_t)(End - X);
+				X = Next;
+			}
+			std::copy(m_BackGlyph.begin() + Row,m_BackGlyph.begin() + Row + m_Width,m_FrontGlyph.begin() + Row);
+			std::copy(m_BackAttr.begin() + Row,m_BackAttr.begin() + Row + m_Width,m_FrontAttr.begin() + Row);
+		}
+		return Emitted;
+	}
+};
+
+#endif
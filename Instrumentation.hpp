@@ -0,0 +1,150 @@
+#ifndef INSTRUMENTATION_HPP_
+#define INSTRUMENTATION_HPP_
+
+/** @file Timing instrumentation
+ * @brief Lock-free latency histograms for proving how accurate the beat actually is
+ */
+
+#include <algorithm> //min
+#include <array>     //array
+#include <atomic>    //atomic
+#include <chrono>    //std::chrono
+#include <cstdint>   //uint64_t
+#include <iomanip>   //setw
+#include <ostream>   //ostream
+
+/** @brief HDR-style log-linear histogram of nanosecond durations
+ * Every power of two is split into 2^SubBucketBits linear buckets, giving a relative error of
+ * ~3% over the full 64-bit range with a fixed 15KB footprint.  Record is wait-free (one relaxed
+ * fetch_add plus a rarely-taken CAS for the maximum) and can be called from any thread.
+ */
+struct LatencyHistogram {
+	static constexpr unsigned SubBucketBits = 5;
+	static constexpr unsigned SubBuckets = 1u << SubBucketBits;
+	static constexpr unsigned NumBuckets = (64 - SubBucketBits + 1) * SubBuckets;
+private:
+	std::array<std::atomic<uint64_t>,NumBuckets> m_Counts {}; ///<Samples per bucket
+	std::atomic<uint64_t> m_Max {0};                          ///<Largest sample seen
+
+	/** @brief Bucket holding a value */
+	static unsigned BucketOf(uint64_t V) {
+		if (V < SubBuckets) return (unsigned)V;
+		unsigned Exponent = 63 - __builtin_clzll(V);
+		unsigned Shift = Exponent - SubBucketBits;
+		return (Exponent - SubBucketBits + 1) * SubBuckets + (unsigned)((V >> Shift) & (SubBuckets - 1));
+	}
+
+	/** @brief Largest value that falls into a bucket */
+	static uint64_t UpperBoundOf(unsigned Bucket) {
+		if (Bucket < SubBuckets) return Bucket;
+		unsigned Shift = Bucket / SubBuckets - 1;
+		uint64_t Sub = SubBuckets + Bucket % SubBuckets;
+		return ((Sub + 1) << Shift) - 1;
+	}
+public:
+	/** @brief Record a duration in nanoseconds (negative durations count as zero) */
+	void Record(long long Nanos) {
+		uint64_t V = Nanos > 0 ? (uint64_t)Nanos : 0;
+		m_Counts[BucketOf(V)].fetch_add(1,std::memory_order_relaxed);
+		uint64_t Max = m_Max.load(std::memory_order_relaxed);
+		while (V > Max && !m_Max.compare_exchange_weak(Max,V,std::memory_order_relaxed)) {}
+	}
+
+	/** @brief Record a std::chrono duration */
+	template <typename Rep, typename Period>
+	void Record(std::chrono::duration<Rep,Period> D) {
+		Record((long long)std::chrono::duration_cast<std::chrono::nanoseconds>(D).count());
+	}
+
+	/** @brief Number of samples recorded */
+	uint64_t Count() const {
+		uint64_t ret = 0;
+		for (auto const &C : m_Counts) ret += C.load(std::memory_order_relaxed);
+		return ret;
+	}
+
+	/** @brief Largest sample recorded, in nanoseconds */
+	uint64_t Max() const {return m_Max.load(std::memory_order_relaxed);}
+
+	/** @brief Value (in nanoseconds) below which the given percentage of samples fall */
+	uint64_t Percentile(double Percent) const {
+		uint64_t Total = Count();
+		if (Total == 0) return 0;
+		uint64_t Target = (uint64_t)(Percent / 100.0 * (double)Total + 0.5);
+		if (Target < 1) Target = 1;
+		uint64_t Seen = 0;
+		for (unsigned i = 0; i != NumBuckets; i++) {
+			Seen += m_Counts[i].load(std::memory_order_relaxed);
+			if (Seen >= Target) return std::min(UpperBoundOf(i),Max());
+		}
+		return Max();
+	}
+
+	/** @brief Print one row of count and p50/p99/p99.9/max (in microseconds) */
+	void Report(std::ostream &Out, const char* Name) const {
+		auto Micros = [](uint64_t NS) {return (double)NS / 1000.0;};
+		Out << std::left << std::setw(18) << Name << std::right
+		    << std::setw(10) << Count()
+		    << std::fixed << std::setprecision(1)
+		    << std::setw(11) << Micros(Percentile(50.0))
+		    << std::setw(11) << Micros(Percentile(99.0))
+		    << std::setw(11) << Micros(Percentile(99.9))
+		    << std::setw(11) << Micros(Max()) << '\n';
+	}
+};
+
+/** @brief All of the timing measurements taken while the metronome runs */
+struct Instruments {
+	LatencyHistogram TickLateness;  ///<Beat issue time (deadline minus the visual lead) -> timing thread wake-up
+	LatencyHistogram FlashLatency;  ///<Beat issue time -> flash drawn by DrawFlash
+	LatencyHistogram RefreshTime;   ///<Time spent pushing a frame out to the terminal
+	LatencyHistogram LoopTime;      ///<Time spent awake per main loop iteration
+	LatencyHistogram AudioCallback; ///<Time spent mixing one block of audio
+	LatencyHistogram ClockPhase;    ///<Distance of each beat of an external clock from the beat it was followed with
+	LatencyHistogram MidiClockLateness; ///<Pulse due -> MIDI clock byte written
+	std::atomic<uint64_t> DroppedFrames {0}; ///<Beats that were superseded before they could be drawn
+	std::atomic<long long> ClockLockTime {-1}; ///<First pulse of an external clock to the follower locking (nanoseconds; negative: never)
+
+	/** @brief Whether anything has been measured yet */
+	bool Empty() const {
+		return TickLateness.Count() == 0 && FlashLatency.Count() == 0 && RefreshTime.Count() == 0 && LoopTime.Count() == 0 && AudioCallback.Count() == 0 && ClockPhase.Count() == 0 && MidiClockLateness.Count() == 0;
+	}
+
+	/** @brief Print a percentile table for every measurement */
+	void Report(std::ostream &Out) const {
+		Out << "Timing report (microseconds)\n"
+		    << std::left << std::setw(18) << "" << std::right
+		    << std::setw(10) << "count" << std::setw(11) << "p50" << std::setw(11) << "p99"
+		    << std::setw(11) << "p99.9" << std::setw(11) << "max" << '\n';
+		TickLateness.Report(Out,"Tick lateness");
+		FlashLatency.Report(Out,"Flash latency");
+		RefreshTime.Report(Out,"Refresh time");
+		LoopTime.Report(Out,"Loop iteration");
+		if (AudioCallback.Count() != 0) AudioCallback.Report(Out,"Audio callback");
+		if (ClockPhase.Count() != 0) ClockPhase.Report(Out,"Clock phase error");
+		if (MidiClockLateness.Count() != 0) MidiClockLateness.Report(Out,"MIDI clock out");
+		Out << "Dropped frames: " << DroppedFrames.load(std::memory_order_relaxed) << '\n';
+		long long Lock = ClockLockTime.load(std::memory_order_relaxed);
+		if (Lock >= 0) Out << "External clock locked after " << (double)Lock / 1e6 << " ms\n";
+	}
+};
+
+/** @brief The process-wide instrumentation (always on; recording costs a clock read and an atomic add) */
+inline Instruments &Metrics() {
+	static Instruments Instance;
+	return Instance;
+}
+
+/** @brief Records the lifetime of a scope into a histogram */
+struct ScopedTimer {
+private:
+	LatencyHistogram &m_Target;
+	std::chrono::steady_clock::time_point m_Start;
+public:
+	ScopedTimer(const ScopedTimer&) = delete;
+	ScopedTimer& operator=(const ScopedTimer&) = delete;
+	explicit ScopedTimer(LatencyHistogram &Target) : m_Target(Target), m_Start(std::chrono::steady_clock::now()) {}
+	~ScopedTimer() {m_Target.Record(std::chrono::steady_clock::now() - m_Start);}
+};
+
+#endif
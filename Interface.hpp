@@ -2,19 +2,33 @@
 #define INTERFACE_HPP_
 
 #include "Types.hpp"
+#include "BeatPattern.hpp"
+#include "BeatScheduler.hpp"
+#include "Calibration.hpp"
+#include "TapTempo.hpp"
+#include "TempoMap.hpp"
+#include "TimingThread.hpp"
+#include "Instrumentation.hpp"
+#include "Formulas.hpp"
+#include "Framebuffer.hpp"
 
+#include <algorithm>  //min, max
 #include <array>      //array
+#include <charconv>   //to_chars
 #include <chrono>     //std::chrono
-#include <functional> //hash
-#include <iomanip>    //precision
-#include <memory>     //unique_ptr
-#include <sstream>    //stringstream
+#include <cmath>      //round
+#include <cstddef>    //size_t
+#include <fstream>    //ofstream
 #include <string>     //string
 #include <stdexcept>  //exceptions
 
 const long long FlashInterval = 64; //milliseconds to flash up on screen;
 
-/** @brief User input interface */
+/** @brief User input interface
+ * Fields are read directly but must only be changed through the setters: every change bumps Generation and
+ * records it against the field, so consumers detect changes with one integer compare and can ask which
+ * fields changed since the generation they last saw.
+ */
 struct UserInterface {
 	/** @enum Integers defining interface selection */
 	enum class Selection : unsigned {
@@ -24,16 +38,110 @@ struct UserInterface {
 		VISUALIZATION = 3,
 		FLASHING = 4
 	};
+	/** @enum Fields tracked for change detection */
+	enum class Field : unsigned {
+		CurrentSelection = 0,
+		Signature = 1,
+		BPM = 2,
+		Color = 3,
+		Visualization = 4,
+		Flashing = 5,
+		Count = 6
+	};
+	/** @brief Bit of a field in the mask returned by ChangedSince */
+	static constexpr unsigned Bit(Field F) {return 1u << (unsigned)F;}
+
 	const unsigned char MaxVisualizations = 10;   ///<Maximum number to display for visualizations
 	const int MaxColors = 7;                      ///<Maximum number of colour patterns
-	std::array<std::string,5> Labels;             ///<Array of output labels
+	static constexpr std::size_t LabelCapacity = 32; ///<Size of each label buffer (including the terminator)
+	std::array<std::array<char,LabelCapacity>,5> Labels {}; ///<Formatted labels, rewritten only when their field changes
 	int CurrentSelection = 0;                     ///<Currently selected field
 	float BPM = 120;                              ///<Beats per minute field
 	int Color = 0;                                ///<Color field
 	short Signature_Upper = 4;                    ///<Time signature upper field
 	short Signature_Lower = 4;                    ///<time signature lower field
+	short Subdivisions = 1;                       ///<Steps each beat is split into (part of the time signature field)
 	unsigned char VisualizationType = 0;          ///<Selected visualization
 	bool Flashing = false;                        ///<Whether to flash the screen at intervals
+private:
+	unsigned long long m_Generation = 1;          ///<Bumped on every change (0 is never current, so consumers can start from it)
+	std::array<unsigned long long,(std::size_t)Field::Count> m_FieldGeneration {1,1,1,1,1,1}; ///<Generation of each field's last change
+	std::array<unsigned long long,5> m_LabelGeneration {0,0,0,0,0}; ///<Generation each label was last formatted at
+
+	/** @brief Record a change to a field */
+	void Touch(Field F) {
+		m_Generation += 1;
+		m_FieldGeneration[(std::size_t)F] = m_Generation;
+	}
+
+	/** @brief Copy a string to Out (stopping at End) */
+	static char *Append(char *Out, char *End, const char *Str) {
+		while (*Str != '\0' && Out != End) *Out++ = *Str++;
+		return Out;
+	}
+	/** @brief Format a number to Out (stopping at End) */
+	template <typename T>
+	static char *Append(char *Out, char *End, T Value) {
+		std::to_chars_result R = std::to_chars(Out,End,Value);
+		return (R.ec == std::errc()) ? R.ptr : Out;
+	}
+	static char *Append(char *Out, char *End, float Value) {
+		std::to_chars_result R = std::to_chars(Out,End,Value,std::chars_format::general,5);
+		return (R.ec == std::errc()) ? R.ptr : Out;
+	}
+
+	/** @brief Format a label into its buffer */
+	void FormatLabel(int index) {
+		char *Out = Labels[index].data(), *End = Out + LabelCapacity - 1;
+		switch ((Selection)(index)) {
+		case Selection::TIMESIGNATURE:
+			Out = Append(Out,End,"Time signature: ");
+			Out = Append(Out,End,Signature_Upper);
+			Out = Append(Out,End," : ");
+			Out = Append(Out,End,Signature_Lower);
+			if (Subdivisions > 1) {
+				Out = Append(Out,End," x");
+				Out = Append(Out,End,Subdivisions);
+			}
+			break;
+		case Selection::BEATSPERMIN:
+			Out = Append(Out,End,"Beats Per Minute: ");
+			Out = Append(Out,End,BPM);
+			break;
+		case Selection::COLORSEL:
+			Out = Append(Out,End,"Color scheme: ");
+			Out = Append(Out,End,Color);
+			break;
+		case Selection::VISUALIZATION:
+			Out = Append(Out,End,"Visualization: ");
+			Out = Append(Out,End,(unsigned)VisualizationType);
+			break;
+		case Selection::FLASHING:
+			Out = Append(Out,End,Flashing ? "Flashing: Yes" : "Flashing: No");
+			break;
+		}
+		*Out = '\0';
+	}
+public:
+	/** @brief Field shown by a label */
+	static constexpr Field LabelField(int index) {
+		constexpr Field Fields[5] = {Field::Signature,Field::BPM,Field::Color,Field::Visualization,Field::Flashing};
+		return Fields[index];
+	}
+	/** @brief Mask of the fields a label's row depends on (its value and whether it is highlighted) */
+	static constexpr unsigned LabelMask(int index) {return Bit(LabelField(index)) | Bit(Field::CurrentSelection);}
+
+	/** @brief Generation of the last change to any field */
+	unsigned long long Generation() const {return m_Generation;}
+
+	/** @brief Mask of the fields (see Bit) changed after a generation */
+	unsigned ChangedSince(unsigned long long Seen) const {
+		unsigned Mask = 0;
+		for (std::size_t i = 0; i != m_FieldGeneration.size(); i++) {
+			if (m_FieldGeneration[i] > Seen) Mask |= 1u << i;
+		}
+		return Mask;
+	}
 
 	/** @brief UI Element selector (change CurrentSelection based on input) */
 	void MoveSelection(char direction) {
@@ -43,10 +151,16 @@ struct UserInterface {
 		} else if (direction < 0) {
 			if (CurrentSelection > 0) CurrentSelection -= 1;
 			else CurrentSelection = 4;
-		}
+		} else return;
+		Touch(Field::CurrentSelection);
 	}
 	/** @brief Set the BPM value */
-	void SetBPM(float newBPM) {BPM = std::max(0.01f,std::min(newBPM,350.0f));}
+	void SetBPM(float newBPM) {
+		newBPM = std::max(0.01f,std::min(newBPM,350.0f));
+		if (newBPM == BPM) return;
+		BPM = newBPM;
+		Touch(Field::BPM);
+	}
 
 	/** @brief UI Color selection (change Color based on input) */
 	void SetColor(char direction) {
@@ -56,11 +170,37 @@ struct UserInterface {
 		} else if (direction < 0) {
 			if (Color > 0) Color -= 1;
 			else Color = MaxColors;
-		}
+		} else return;
+		Touch(Field::Color);
 	}
 
 	/** @brief Set the time signature based on inputs */
-	void SetSignature(short upper, short lower) {Signature_Upper = upper; Signature_Lower = lower;}
+	void SetSignature(short upper, short lower) {
+		if (upper == Signature_Upper && lower == Signature_Lower) return;
+		Signature_Upper = upper;
+		Signature_Lower = lower;
+		Touch(Field::Signature);
+	}
+
+	/** @brief Step through the common time signatures (see Signatures) */
+	void CycleSignature(char direction) {
+		static constexpr Signature Signatures[] = {{2,4},{3,4},{4,4},{5,4},{6,4},{7,4},{2,2},{3,2},{3,8},{5,8},{6,8},{7,8},{9,8},{12,8}};
+		constexpr int Count = (int)(sizeof(Signatures) / sizeof(Signatures[0]));
+		int Current = 0;
+		while (Current != Count && (Signatures[Current].upper != Signature_Upper || Signatures[Current].lower != Signature_Lower)) Current += 1;
+		if (Current == Count) Current = 2; //not a preset: continue from 4/4
+		Current = (Current + Count + (direction > 0) - (direction < 0)) % Count;
+		SetSignature(Signatures[Current].upper,Signatures[Current].lower);
+	}
+
+	/** @brief Step the subdivisions of each beat through 1 to BeatPattern::MaxSubdivisions */
+	void CycleSubdivisions() {
+		Subdivisions = (short)(Subdivisions % BeatPattern::MaxSubdivisions + 1);
+		Touch(Field::Signature);
+	}
+
+	/** @brief Events of every beat and subdivision of a bar in the current time signature */
+	BeatPattern Pattern() const {return BeatPattern(Signature_Upper,Signature_Lower,Subdivisions);}
 
 	/** @brief UI Visualization selection (change visualization based on input) */
 	void SetVisualization(char direction) {
@@ -70,54 +210,27 @@ struct UserInterface {
 		} else if (direction < 0) {
 			if (VisualizationType > 0) VisualizationType -= 1;
 			else VisualizationType = MaxVisualizations;
-		}
+		} else return;
+		Touch(Field::Visualization);
 	}
 
 	/** @brief Set flashing selection (inverse of what is currently selected) */
-	void ToggleFlashing() {Flashing = !Flashing;}
+	void ToggleFlashing() {
+		Flashing = !Flashing;
+		Touch(Field::Flashing);
+	}
 
 	/** @brief Returns the number of labels available (this MUST be updated if options are added to the UI) */
 	constexpr int NumberOfLabels() {return 5;}
 
-	/** @brief Rewrites label strings */
-	std::string GetLabel(int index) {
-		Selection Sel = (Selection)(index);
-		std::stringstream Str;
-		if (Sel == Selection::TIMESIGNATURE) {
-			Str << "Time signature: " << Signature_Upper << " : " << Signature_Lower;
-		} else if (Sel == Selection::BEATSPERMIN) {
-			Str << std::setprecision(5) <<  "Beats Per Minute: " << BPM;
-		} else if (Sel == Selection::COLORSEL) {
-			Str << "Color scheme: " << Color;
-		} else if (Sel == Selection::VISUALIZATION) {
-			Str << "Visualization: " << (unsigned)VisualizationType;
-		} else if (Sel == Selection::FLASHING) {
-			Str << "Flashing: ";
-			if (!Flashing) {Str << "No";}
-			else {Str << "Yes";}
+	/** @brief Label text, reformatted (without allocating) only if its field changed since it was last asked for */
+	const char *GetLabel(int index) {
+		std::size_t F = (std::size_t)LabelField(index);
+		if (m_LabelGeneration[index] < m_FieldGeneration[F]) {
+			FormatLabel(index);
+			m_LabelGeneration[index] = m_FieldGeneration[F];
 		}
-		Labels[index] = Str.str();
-		return Labels[index];
-	}
-
-	/** @brief Computes a "hash" of the user input selections */
-	std::size_t hash() const {
-		std::size_t hash = 99194853094755497;
-		std::size_t I = std::hash<int>()(CurrentSelection);
-		hash = ((hash << 5) + hash) + I;
-		I = std::hash<float>()(BPM);
-		hash = ((hash << 5) + hash) + I;
-		I = std::hash<int>()(Color);
-		hash = ((hash << 5) + hash) + I;
-		I = std::hash<short>()(Signature_Upper);
-		hash = ((hash << 5) + hash) + I;
-		I = std::hash<short>()(Signature_Lower);
-		hash = ((hash << 5) + hash) + I;
-		I = std::hash<unsigned char>()(VisualizationType);
-		hash = ((hash << 5) + hash) + I;
-		I = std::hash<bool>()(Flashing);
-		hash = ((hash << 5) + hash) + I;
-		return hash;
+		return Labels[index].data();
 	}
 };
 
@@ -146,6 +259,18 @@ struct WindowHandle {
 	virtual void resize(int ysz, int xsz) = 0;
 	/** @brief Move the window */
 	virtual void move(int ypt, int xpt) = 0;
+	/** @brief Rasterize primitives at sub-cell resolution (windows that cannot simply ignore it) */
+	virtual void SetResolution(SubCellMode Mode) {Unused(Mode);}
+	/** @brief Capture everything drawn inside the window since the last FillScreen */
+	virtual void CaptureSprite(CellSprite &S) {
+		Unused(S);
+		throw std::runtime_error("Not Implemented");
+	}
+	/** @brief Draw a captured sprite, or erase it with the current background */
+	virtual void DrawSprite(CellSprite const &S, bool Erase = false) {
+		Unused(S, Erase);
+		throw std::runtime_error("Not Implemented");
+	}
 
 	/* Primitives */
 	/** @brief Draw a circle of radius at a location with a border color, thickness, and optional fill */
@@ -154,39 +279,170 @@ struct WindowHandle {
 	virtual void DrawTriangle(Position<float> const &Pt1, Position<float> const &Pt2, Position<float> const &Pt3, ColorType<unsigned char> Border, float BorderThickness, Position<float> const &Offset = {0,0}, bool Fill = false, ColorType<unsigned char> FillColor = {0,0,0,0}) = 0;
 	/** @brief Draw a line between two points with a border, thickness, and offset */
 	virtual void DrawLine(Position<float> const &Pt1, Position<float> const &Pt2, float Thickness, Position<float> const &Offset = {0,0}) = 0;
+	/** @brief Fill the cells whose centres lie in the rectangle [Pt1,Pt2) */
+	virtual void DrawRect(Position<float> const &Pt1, Position<float> const &Pt2, ColorType<unsigned char> FillColor) {
+		Unused(Pt1, Pt2, FillColor);
+		throw std::runtime_error("Not Implemented");
+	}
+	/** @brief Draw N single points given as separate X and Y arrays (eg: particles) */
+	virtual void DrawPoints(float const *X, float const *Y, std::size_t N, ColorType<unsigned char> Color) {
+		Unused(X, Y, N, Color);
+		throw std::runtime_error("Not Implemented");
+	}
 	/** @brief Fill entire screenn with a colour */
 	virtual void FillScreen(ColorType<unsigned char> FillColor) = 0;
 };
 
+/** @brief The time drawing runs on: the steady clock, or a manual clock that only moves when it is set
+ * With a manual clock (and the timing thread on the same time, see TimingThread::Advance) a run draws the same
+ * frames every time, eg: a scripted headless run.
+ */
+struct FrameClock {
+	using TimePoint = std::chrono::steady_clock::time_point;
+private:
+	bool m_Manual = false; ///<Whether the time only moves through Set
+	TimePoint m_Time;      ///<The manual time
+public:
+	/** @brief The current time */
+	TimePoint Now() const {return m_Manual ? m_Time : std::chrono::steady_clock::now();}
+
+	/** @brief Stop following the steady clock and hold the time at T until it is set again */
+	void Set(TimePoint T) {
+		m_Manual = true;
+		m_Time = T;
+	}
+
+	/** @brief Whether the time only moves through Set */
+	bool Manual() const {return m_Manual;}
+};
+
 /** @brief Basic class for drawing visualizations to screen */
 struct VisualOutput {
 protected:
-	std::chrono::time_point<std::chrono::steady_clock> FirstTick; ///<The first metronome tick time
+	FrameClock const *Time = nullptr;                             ///<Where the current time comes from (non-owning; null for the steady clock)
 	std::chrono::time_point<std::chrono::steady_clock> LastTick;  ///<The last time the metronome ticked
+	unsigned long long LastBeat = 0;                              ///<Index of the last beat received
+	BeatEvent LastEvent = BeatEvent::Downbeat;                    ///<Place of the last beat received in its bar
+	std::chrono::nanoseconds BeatLength {0};                      ///<Length of the last beat received (0 before the first)
+	bool BeatPending = false;                                     ///<A beat has been received but not yet drawn
+	long long DroppedFrames = 0;                                  ///<Beats that arrived while a previous beat was still waiting to be drawn
 	std::chrono::time_point<std::chrono::steady_clock> TickTimer; ///<A timer used to control the amount of time a 'flash' is on screen
-	long long FlashCounter = 0;                                   ///<A counter for the number of times the metronome has ticked
+
+	/** @brief Length of time a flash stays on screen: a sixth of a beat, clamped to [24,FlashInterval] ms */
+	static std::chrono::nanoseconds FlashDuration(float BPM) {
+		double NanosPerFlash = ComputeNanosecondsPerBeat((double)BPM) / 6.0;
+		NanosPerFlash = std::max(std::min(NanosPerFlash,FlashInterval * 1e6),24 * 1e6);
+		return std::chrono::nanoseconds((long long)NanosPerFlash);
+	}
+
+	/** @brief Nanoseconds in the current beat (which a tempo map can make differ from UI.BPM) */
+	double BeatNanos(UserInterface const &UI) const {
+		return BeatLength.count() > 0 ? (double)BeatLength.count() : ComputeNanosecondsPerBeat((double)UI.BPM);
+	}
+
+	/** @brief Tempo of the current beat */
+	float BeatBPM(UserInterface const &UI) const {return (float)(60e9 / BeatNanos(UI));}
+
+	/** @brief The current time */
+	std::chrono::steady_clock::time_point Now() const {return Time ? Time->Now() : std::chrono::steady_clock::now();}
 public:
 	WindowHandle *Win;                                            ///<Non-owning pointer to a window;
 	static constexpr bool IsVisualType() {return true;}           ///<Returns that any derived classes are of visual type (guaranteeing certain draw options)
 	virtual void DrawFlash(UserInterface const &UI) = 0;          ///<Draw the flash visualization
 	virtual void DrawMetronome(UserInterface const &UI) = 0;      ///<Draw the metronome visualization
 	virtual void DrawRaindrops(UserInterface const &UI) = 0;      ///<Draw the raindrops visualization
+	virtual void DrawProgress(UserInterface const &UI) = 0;       ///<Draw the progress bar visualization
 	virtual void ForceRedraw() = 0;                               ///<Force the entire output to be redrawn
+	/** @brief Time at which the output next needs to change (time_point::max() if never) */
+	virtual std::chrono::steady_clock::time_point NextDeadline(UserInterface const &UI) const = 0;
+	/** @brief Receive a beat from the beat clock; it is drawn on the next Draw* call */
+	virtual void OnBeat(BeatScheduler::Tick const &T) {
+		if (BeatPending) {
+			DroppedFrames += 1;
+			Metrics().DroppedFrames.fetch_add(1,std::memory_order_relaxed);
+		}
+		BeatPending = true;
+		LastTick = T.Deadline - T.Lead; //everything is drawn ahead by the lead, so it is seen on the beat
+		LastBeat = T.Index;
+		LastEvent = T.Event;
+		BeatLength = T.Length;
+	}
+	/** @brief Number of beats that were never drawn because rendering fell behind */
+	long long GetDroppedFrames() const {return DroppedFrames;}
 };
 
 /** @brief Basic class for drawing windows to screen */
 struct Drawer {
 protected:
-	std::unique_ptr<VisualOutput> m_VOut = nullptr;               ///<Visual output owning pointer (should be contained within the drawer)
+	VisualOutput *m_VOut = nullptr;                               ///<Visual output (non-owning: the derived drawer owns it with its full type)
+	FrameClock const *m_Clock = nullptr;                          ///<Where the current time comes from (non-owning; null for the steady clock)
+	bool m_InFrame = false;                                       ///<Between BeginFrame and CommitFrame: Refresh only stages output
+	std::chrono::steady_clock::time_point m_FrameStart;           ///<When the current frame was begun
+	double m_FrameNanos = 0.0;                                    ///<Measured: smoothed time from BeginFrame to the end of CommitFrame
+	std::chrono::nanoseconds m_DisplayLatency {0};                ///<Declared: time from a frame leaving the program to it being visible
+	/** @brief Put everything staged by Refresh on screen at once */
+	virtual void Flush() {}
+	/** @brief The current time */
+	std::chrono::steady_clock::time_point Now() const {return m_Clock ? m_Clock->Now() : std::chrono::steady_clock::now();}
 public:
-	Location Orientation = Location::North;                       ///<Orientation of the user interface (TODO: this should be configurable?)
-	void SetOrientation(Location L) {
+	static constexpr int InputRows = 7;                           ///<Height of the input panel when it sits north or south
+	static constexpr int InputColumns = 28;                       ///<Width of the input panel when it sits east or west
+	static constexpr std::chrono::nanoseconds TerminalLatency {16666667}; ///<Display latency assumed for a terminal emulator (one 60Hz frame)
+	Location Orientation = Location::North;                       ///<Side of the screen the user interface sits on
+	/** @brief Move the user interface to another side of the screen */
+	virtual void SetOrientation(Location L) {
 		Orientation = L;
 	}
+
+	/** @brief Size and top-left corner of a pane */
+	struct PaneGeometry {
+		int Height;
+		int Width;
+		int Y;
+		int X;
+	};
+	/** @brief Where a pane sits on a screen: the input panel on the Orientation side, the visuals filling the rest */
+	PaneGeometry Layout(Pane P, BoxSize<int> Screen) const {
+		bool Input = (P == Pane::Input);
+		int Rows = std::max(1,std::min(InputRows,Screen.Y - 1));
+		int Columns = std::max(1,std::min(InputColumns,Screen.X - 1));
+		switch (Orientation) {
+		case Location::North: return Input ? PaneGeometry{Rows,Screen.X,0,0} : PaneGeometry{Screen.Y - Rows,Screen.X,Rows,0};
+		case Location::South: return Input ? PaneGeometry{Rows,Screen.X,Screen.Y - Rows,0} : PaneGeometry{Screen.Y - Rows,Screen.X,0,0};
+		case Location::West:  return Input ? PaneGeometry{Screen.Y,Columns,0,0} : PaneGeometry{Screen.Y,Screen.X - Columns,0,Columns};
+		case Location::East:  return Input ? PaneGeometry{Screen.Y,Columns,0,Screen.X - Columns} : PaneGeometry{Screen.Y,Screen.X - Columns,0,0};
+		}
+		return {Screen.Y,Screen.X,0,0};
+	}
+	/** @brief Resolution the visuals are rasterized at */
+	void SetResolution(SubCellMode Mode) {
+		if (m_VOut && m_VOut->Win) m_VOut->Win->SetResolution(Mode);
+	}
 	static constexpr bool IsDrawerType() {return true;}           ///<Returns that any derived classes are of Drawer type (guaranteeing certain functions)
+	/** @brief Take the time from a clock (set before the visual window is created, which keeps the clock) */
+	void SetClock(FrameClock const *Clock) {m_Clock = Clock;}
+	/** @brief Start a frame: until CommitFrame, Refresh (and Redraw) stage their output instead of writing it */
+	void BeginFrame() {
+		m_InFrame = true;
+		m_FrameStart = Now();
+	}
+	/** @brief End the frame, putting everything staged since BeginFrame on screen with one flush */
+	void CommitFrame() {
+		if (!m_InFrame) return;
+		m_InFrame = false;
+		Flush();
+		double Took = (double)std::chrono::nanoseconds(Now() - m_FrameStart).count(); //nothing on a manual clock
+		m_FrameNanos += (Took - m_FrameNanos) / 16.0;
+	}
+	/** @brief Declare how long a flushed frame takes to become visible (eg: from a calibration) */
+	void SetDisplayLatency(std::chrono::nanoseconds L) {m_DisplayLatency = std::max(L,std::chrono::nanoseconds(0));}
+	/** @brief Declared display latency (see SetDisplayLatency) */
+	std::chrono::nanoseconds DisplayLatency() const {return m_DisplayLatency;}
+	/** @brief Time from starting a frame to it being visible: the measured frame time plus the declared display latency */
+	std::chrono::nanoseconds Latency() const {return m_DisplayLatency + std::chrono::nanoseconds((long long)m_FrameNanos);}
 	/** @brief Redraw all elements on the window */
 	virtual void Redraw() = 0;
-	/** @brief Refresh the window */
+	/** @brief Refresh the window (staged if inside a frame, otherwise flushed immediately) */
 	virtual void Refresh() = 0;
 	/** @brief Get the size of the current window */
 	virtual BoxSize<int> GetWindowSize() = 0;
@@ -200,12 +456,56 @@ public:
 	virtual void CreateVisualWindow() = 0;
 	/** @brief Handle full user's input */
 	virtual void HandleInput(FullInput const &Interaction) = 0;
+	/** @brief Time at which the screen next needs to change (time_point::max() if never) */
+	virtual std::chrono::steady_clock::time_point NextDeadline(UserInterface const &UI) {
+		if (!m_VOut) return std::chrono::steady_clock::time_point::max();
+		return m_VOut->NextDeadline(UI);
+	}
+	/** @brief Pass a beat from the beat clock on to the visual output */
+	virtual void OnBeat(BeatScheduler::Tick const &T) {
+		if (m_VOut) m_VOut->OnBeat(T);
+	}
 };
 
 /** @brief User input handling 
  * This class acts as an interface between the output system (be it ncurses, opengl, webgui, etc) and the UserInterface class allowing any arbitrary input to be translated to something that can modify the UserInterface options
  */
 struct PipeInputToUI {
+protected:
+	/** @brief Handle the user "selection" key */
+	static void HandleSelectionKey(UserInterface &UI) {
+		switch ((UserInterface::Selection)(UI.CurrentSelection)) {
+		case UserInterface::Selection::TIMESIGNATURE: UI.CycleSubdivisions(); break;
+		case UserInterface::Selection::BEATSPERMIN: break;                    //need to create window
+		case UserInterface::Selection::COLORSEL: break;                       //Not applicable
+		case UserInterface::Selection::VISUALIZATION: break;                  //Not applicable
+		case UserInterface::Selection::FLASHING: UI.ToggleFlashing(); break;
+		default: break;
+		}
+	}
+
+	/** @brief Handle the user's keyboard arrow key input */
+	static void HandleArrowKey(UserInterface &UI, char Direction) {
+		switch ((UserInterface::Selection)(UI.CurrentSelection)) {
+		case UserInterface::Selection::TIMESIGNATURE: //Next/previous common time signature
+			UI.CycleSignature(Direction);
+			break;
+		case UserInterface::Selection::BEATSPERMIN:   //Increment BPM
+			UI.SetBPM(UI.BPM + (float)((Direction > 0) - (UI.BPM > 1.0f && Direction < 0)));
+			break;
+		case UserInterface::Selection::COLORSEL:      //Increment color
+			UI.SetColor((Direction > 0) - (Direction < 0));
+			break;
+		case UserInterface::Selection::VISUALIZATION: //Increment visualization
+			UI.SetVisualization(Direction);
+			break;
+		case UserInterface::Selection::FLASHING:      //Increment flashing
+			UI.ToggleFlashing(); 
+			break;
+		default: break;
+		}
+	}
+public:
 	static constexpr bool IsInputHandler() {return true;}
 	/** @brief Pipe user's keyboard input to the user interface */
 	virtual int Keyboard(UserInterface &UI) = 0;
@@ -221,29 +521,82 @@ class MainWindow {
 	static_assert(WindowSystem::IsDrawerType(),"Window system must be derived from Drawer type");
 	static_assert(InputSystem::IsInputHandler(),"Input system must be derived from PipeInputToUI type");
 private:
+	FrameClock m_Time;                                 ///<The time the window runs on
 	UserInterface m_UI;                                ///<The user interface
 	WindowSystem m_WS;                                 ///<The window system to be used for output
 	InputSystem m_Input;                               ///<The system by which input is captured
+	TimingThread m_Clock;                              ///<The beat clock, running on its own thread
+	unsigned long long m_ClockGeneration = 0;          ///<UI generation the beat clock was last synchronised with
+	bool m_ClockRunning = false;                       ///<Whether the beat clock is delivering beats
+	BeatScheduler::TimePoint m_LastDeadline;           ///<Deadline of the last beat received
+	double m_LastLength = 0.0;                         ///<Nanoseconds from the last beat received to the next
+	TempoMap m_Tempo;                                  ///<Tempo automation (empty: hold UI.BPM)
+	unsigned long long m_TempoGeneration = 0;          ///<UI generation the tempo map was set at
+	LatencyCalibrator m_Calibration;                   ///<Taps collected while calibrating the visual latency
+	TapTempo m_Taps;                                   ///<Taps on the tap tempo key
+	std::string m_ReportPath;                          ///<File the timing report is written to on request (empty: none)
+
+	/** @brief Start or stop the beat clock when flashing is toggled, and hand it any other change to its settings
+	 * Tempo and time signature changes carry on from the current beat and bar rather than restarting the grid.
+	 */
+	void SyncClock() {
+		m_Clock.SetLead(m_WS.Latency());
+		if (m_UI.Generation() == m_ClockGeneration) return;
+		unsigned Changed = m_UI.ChangedSince(m_ClockGeneration);
+		m_ClockGeneration = m_UI.Generation();
+		if (!m_Tempo.Empty() && (m_UI.ChangedSince(m_TempoGeneration) & UserInterface::Bit(UserInterface::Field::BPM))) m_Tempo = TempoMap(); //a manual tempo overrides the automation
+		if (Changed & UserInterface::Bit(UserInterface::Field::Flashing)) {
+			m_ClockRunning = m_UI.Flashing;
+			if (m_ClockRunning) m_Clock.Start(m_Time.Now(),m_Tempo.Empty() ? TempoMap::Constant(m_UI.BPM) : m_Tempo,m_UI.Pattern());
+			else m_Clock.Stop();
+			return;
+		}
+		if (!m_ClockRunning) return;
+		if (Changed & UserInterface::Bit(UserInterface::Field::BPM)) m_Clock.Retime(m_Time.Now(),m_UI.BPM);
+		if (Changed & UserInterface::Bit(UserInterface::Field::Signature)) m_Clock.SetPattern(m_UI.Pattern());
+	}
+
+	/** @brief Hand every beat published by the timing thread to the window system */
+	void ReceiveBeats() {
+		m_Clock.AcknowledgeTicks();
+		BeatScheduler::Tick T;
+		while (m_Clock.PopTick(T)) {
+			if (!m_ClockRunning) continue;
+			m_WS.OnBeat(T);
+			if (m_Clock.Following() && T.Length.count() > 0) m_UI.SetBPM((float)(std::round(6e11 / (double)T.Length.count()) / 10.0)); //show the external tempo
+			m_LastDeadline = T.Deadline;
+			m_LastLength = (double)T.Length.count();
+		}
+	}
 public:
-	MainWindow() {
+	MainWindow(TimingThread::Options ClockOptions = TimingThread::Options()) : m_Clock(ClockOptions) {
+		if (ClockOptions.Manual) m_Time.Set(FrameClock::TimePoint()); //every run starts from the same time
+		m_WS.SetClock(&m_Time);
 		m_WS.CreateInputWindow();
 		m_WS.CreateVisualWindow();
 		Refresh();
 	}
 	
-	/** @brief Refresh the screen without necessarily redrawing everything */
+	/** @brief Refresh the screen without necessarily redrawing everything; ends the frame started by Draw */
 	void Refresh() {
+		ScopedTimer Timer(Metrics().RefreshTime);
 		m_WS.Refresh();
+		m_WS.CommitFrame();
 	}
 
-	/** @brief Force redraw everything on screen */
+	/** @brief Force redraw everything on screen (in a single flush) */
 	void Redraw() {
+		m_WS.BeginFrame();
 		m_WS.Redraw();
 		m_WS.Refresh();
+		m_WS.CommitFrame();
 	}
 
-	/** @brief Draw the screen in its current state */
+	/** @brief Draw the screen in its current state; nothing reaches the terminal until Refresh */
 	void Draw() {
+		m_WS.BeginFrame();
+		SyncClock();
+		ReceiveBeats();
 		PrintUI();
 		UpdateVisual();
 	}
@@ -260,17 +613,85 @@ public:
 
 	/** @brief Get input from the input system. 
 	 * TODO: In the future, we may need to include parser for mouse, midi, or other options
+	 * @param Arrival  When the input arrived, used to time taps
 	 */
-	FullInput HandleInput(bool &Running) {
+	FullInput HandleInput(bool &Running, std::chrono::steady_clock::time_point Arrival) {
 		FullInput Ret;
 		Ret.Keypress = m_Input.Keyboard(m_UI);
 		if (Ret.Keypress == 'q') { 
 			Running = false; //exit key
-		} else {
+		} else if (Ret.Keypress == 'p') { //dump timing statistics to a file: the terminal is repainted before it could be read there
+			if (!m_ReportPath.empty()) {
+				std::ofstream Out(m_ReportPath);
+				Metrics().Report(Out);
+			}
+		} else if (Ret.Keypress == 't') { //tap tempo
+			if (m_Taps.Tap(Arrival)) m_UI.SetBPM((float)(std::round(m_Taps.BPM() * 100.0) / 100.0));
+		} else if (Ret.Keypress == 'c') { //calibrate the visual latency: tap space along with the flash
+			StartCalibration();
+		} else if (Ret.Keypress == ' ' && m_Calibration.Active()) {
+			if (m_ClockRunning && m_Calibration.Tap(Arrival,m_LastDeadline,m_LastLength)) {
+				m_WS.SetDisplayLatency(m_WS.DisplayLatency() + m_Calibration.Offset()); //the offset is what the current lead missed by
+			}
+		} else if (Ret.Keypress != InputSystem::NoInput) {
 			m_WS.HandleInput(Ret);
 		}
 		return Ret;
 	}
+
+	/** @brief Follow a tempo map (segments in bars of the current time signature) from the next start of the clock
+	 * The map applies until the BPM is changed by hand.
+	 */
+	void SetTempoMap(TempoMap const &Tempo) {
+		m_Tempo = Tempo;
+		m_TempoGeneration = m_UI.Generation();
+		m_ClockGeneration = 0; //restart with it if the clock is running
+	}
+
+	/** @brief Write the timing report to a file (overwriting it) whenever 'p' is pressed */
+	void SetReportFile(std::string const &Path) {m_ReportPath = Path;}
+
+	/** @brief Start measuring the visual latency from taps made along with the flash (turns flashing on) */
+	void StartCalibration() {
+		if (!m_UI.Flashing) m_UI.ToggleFlashing();
+		m_Calibration.Start();
+	}
+
+	/** @brief Taps collected by the latency calibration */
+	LatencyCalibrator const &Calibration() const {return m_Calibration;}
+
+	/** @brief Consume all input that is currently pending (input system must be non-blocking)
+	 * @param Arrival  When the input arrived (eg: EventLoop::Events::Woken), used to time taps
+	 */
+	void HandlePendingInput(bool &Running, std::chrono::steady_clock::time_point Arrival = std::chrono::steady_clock::now()) {
+		while (Running && HandleInput(Running,Arrival).Keypress != InputSystem::NoInput) {}
+	}
+
+	/** @brief The time the window runs on */
+	FrameClock::TimePoint Now() const {return m_Time.Now();}
+
+	/** @brief Move a manual clock (see TimingThread::Options::Manual) on to T and collect the beats due by then */
+	void Advance(FrameClock::TimePoint T) {
+		m_Time.Set(T);
+		m_Clock.Advance(T);
+	}
+
+	/** @brief Time at which the screen next needs to be redrawn */
+	std::chrono::steady_clock::time_point NextDeadline() {
+		return m_WS.NextDeadline(m_UI);
+	}
+
+	/** @brief The beat clock (its TickNotifier should be watched by the event loop) */
+	TimingThread &Clock() {return m_Clock;}
+
+	/** @brief The window system (eg: for inspecting a headless frame) */
+	WindowSystem &Windows() {return m_WS;}
+
+	/** @brief The input system (eg: for queueing scripted input) */
+	InputSystem &Input() {return m_Input;}
+
+	/** @brief The user interface state */
+	UserInterface const &UI() const {return m_UI;}
 };
 
 #endif
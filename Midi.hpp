@@ -0,0 +1,298 @@
+#ifndef MIDI_HPP_
+#define MIDI_HPP_
+
+/** @file MIDI clock
+ * @brief Raw MIDI ports, a follower that turns an external 24 PPQN clock into a smooth beat clock, and a sender
+ * that clocks other devices from the beat clock
+ */
+
+#include "BeatScheduler.hpp"
+#include "Instrumentation.hpp"
+
+#include <algorithm> //max
+#include <chrono>    //std::chrono
+#include <cmath>     //abs, floor, llround
+#include <cstddef>   //size_t
+#include <stdexcept> //exceptions
+#include <string>    //string
+
+#include <fcntl.h>    //open
+#include <sys/stat.h> //stat, S_ISFIFO
+#include <unistd.h>   //close, write
+
+/** @brief MIDI system real-time and common messages used for clock sync */
+enum MidiStatus : unsigned char {
+	MidiSongPosition = 0xF2, ///<Song position pointer (two data bytes: 16th notes from the start, LSB first)
+	MidiClock = 0xF8,        ///<Timing clock, 24 per quarter note
+	MidiStart = 0xFA,        ///<Start from the beginning (the next clock is the first beat)
+	MidiContinue = 0xFB,     ///<Continue from the song position
+	MidiStop = 0xFC          ///<Stop
+};
+
+/** @brief A raw MIDI device (eg: /dev/snd/midiC1D0) or named FIFO, opened non-blocking
+ * A FIFO is opened read-write, so it neither reports end of file while nothing is writing to it nor fails to
+ * open while nothing is reading from it; this makes it a stand-in for a device in tests.
+ */
+struct MidiPort {
+private:
+	int m_FD = -1; ///<Owning descriptor
+public:
+	MidiPort(const MidiPort&) = delete;
+	MidiPort& operator=(const MidiPort&) = delete;
+
+	/** @param Output  Open for writing rather than reading */
+	MidiPort(std::string const &Path, bool Output) {
+		struct stat Info;
+		bool FIFO = (::stat(Path.c_str(), &Info) == 0 && S_ISFIFO(Info.st_mode));
+		int Mode = FIFO ? O_RDWR : Output ? O_WRONLY : O_RDONLY;
+		m_FD = ::open(Path.c_str(), Mode | O_NONBLOCK | O_CLOEXEC | O_NOCTTY);
+		if (m_FD < 0) throw std::runtime_error("cannot open MIDI port " + Path);
+	}
+	~MidiPort() {
+		if (m_FD >= 0) ::close(m_FD);
+	}
+
+	/** @brief Descriptor to poll and read or write */
+	int FD() const {return m_FD;}
+};
+
+/** @brief What a byte of MIDI input meant to the clock */
+enum class MidiClockEvent : unsigned char {
+	None,     ///<Nothing for the beat clock (eg: a clock while stopped, or part of another message)
+	Pulse,    ///<A clock pulse while playing (see MidiClockFollower::Pulse)
+	Start,    ///<Playing from the beginning
+	Continue, ///<Playing from the song position
+	Stop      ///<Stopped
+};
+
+/** @brief Follows an external MIDI clock with a delay-locked loop
+ * Clock bytes arrive with the jitter of the sender, the cable and the kernel (often a millisecond or more over
+ * USB), so each is compared with where the loop predicted it, and the error nudges both the predicted phase (by
+ * B) and the pulse period (by C): a second-order loop whose bandwidth sets how fast it follows tempo changes
+ * against how much jitter it lets through.  The loop keeps running while the transport is stopped (most senders
+ * keep clocking), so a Start is followed at the right tempo straight away; it starts over after a long gap.
+ * Pulses are numbered from the song position, so pulse 0 is the first beat of the song.  The loop counts as
+ * locked once its period has held steady to within LockTolerance over a whole beat.
+ */
+struct MidiClockFollower {
+	using Clock = std::chrono::steady_clock;
+	using TimePoint = Clock::time_point;
+	using Nanoseconds = std::chrono::nanoseconds;
+	static constexpr int PPQN = 24;                    ///<Clock pulses per beat
+	static constexpr double Bandwidth = 0.5;           ///<Loop bandwidth (Hz)
+	static constexpr double LockTolerance = 0.002;     ///<Largest change of the period over a beat while locked
+	static constexpr long long MaxGap = 500000000;     ///<Longest gap between pulses before the loop starts over (20 BPM)
+private:
+	enum class Transport : unsigned char {Unknown, Playing, Stopped};
+	Transport m_Transport = Transport::Unknown; ///<Whether pulses belong to the song (clock only senders never say)
+	long long m_NextPulse = 0;       ///<Number of the next pulse in the song
+	long long m_Pulse = -1;          ///<Number of the last pulse in the song
+	int m_SongPosition = -1;         ///<Song position being received (-1: none; -2: waiting for the LSB; else LSB waiting for the MSB)
+	long long m_Pulses = 0;          ///<Pulses the loop has seen since it (re)started
+	TimePoint m_Arrival;             ///<When the last pulse arrived
+	double m_Time = 0.0;             ///<Filtered time of the last pulse (nanoseconds since the epoch)
+	double m_Period = 0.0;           ///<Filtered nanoseconds per pulse
+	double m_Error = 0.0;            ///<Arrival of the last pulse minus its prediction (nanoseconds)
+	double m_BeatPeriod = 0.0;       ///<Period at the last whole beat of pulses, for lock detection
+	TimePoint m_Unlocked;            ///<First pulse since the loop (re)started or lost lock
+	bool m_Locked = false;           ///<Whether the period has settled
+	Nanoseconds m_LockTime {-1};     ///<Time it took to lock, for the last lock
+
+	static double Nanos(TimePoint T) {return (double)std::chrono::duration_cast<Nanoseconds>(T.time_since_epoch()).count();}
+
+	/** @brief Run the loop on a pulse arriving At */
+	void Track(TimePoint At) {
+		double T = Nanos(At);
+		if (m_Pulses != 0 && (At - m_Arrival) > Nanoseconds(MaxGap)) m_Pulses = 0;
+		m_Arrival = At;
+		if (m_Pulses == 0) { //first pulse: nothing to predict from yet
+			m_Time = T;
+			m_Unlocked = At;
+			m_Locked = false;
+			m_Pulses = 1;
+			return;
+		}
+		if (m_Pulses == 1) { //second pulse: the first period is the raw interval
+			m_Period = T - m_Time;
+			m_Time = T;
+			m_Error = 0.0;
+			m_BeatPeriod = m_Period;
+			m_Pulses = 2;
+			return;
+		}
+		double Omega = 6.283185307179586 * Bandwidth * m_Period / 1e9;
+		m_Error = T - (m_Time + m_Period);
+		m_Time += m_Period + 1.4142135623730951 * Omega * m_Error;
+		m_Period += Omega * Omega * m_Error;
+		m_Pulses += 1;
+		if (m_Pulses % PPQN == 0) {
+			bool Steady = std::abs(m_Period - m_BeatPeriod) <= LockTolerance * m_Period;
+			if (Steady && !m_Locked) m_LockTime = At - m_Unlocked;
+			if (!Steady && m_Locked) m_Unlocked = At;
+			m_Locked = Steady;
+			m_BeatPeriod = m_Period;
+		}
+	}
+public:
+	/** @brief Take one byte of MIDI input that arrived At */
+	MidiClockEvent Feed(unsigned char Byte, TimePoint At) {
+		if (Byte >= 0xF8) { //real-time messages may appear anywhere, even inside other messages
+			switch (Byte) {
+			case MidiClock:
+				Track(At);
+				if (m_Transport == Transport::Stopped) return MidiClockEvent::None;
+				m_Pulse = m_NextPulse++;
+				return MidiClockEvent::Pulse;
+			case MidiStart:
+				m_Transport = Transport::Playing;
+				m_NextPulse = 0;
+				return MidiClockEvent::Start;
+			case MidiContinue:
+				m_Transport = Transport::Playing;
+				return MidiClockEvent::Continue;
+			case MidiStop:
+				m_Transport = Transport::Stopped;
+				return MidiClockEvent::Stop;
+			default: return MidiClockEvent::None;
+			}
+		}
+		if (Byte == MidiSongPosition) m_SongPosition = -2;
+		else if (Byte & 0x80) m_SongPosition = -1; //any other message
+		else if (m_SongPosition == -2) m_SongPosition = Byte;
+		else if (m_SongPosition >= 0) {
+			m_NextPulse = (long long)(m_SongPosition | (Byte << 7)) * (PPQN / 4); //sixteenth notes
+			m_SongPosition = -1;
+		}
+		return MidiClockEvent::None;
+	}
+
+	/** @brief Whether the loop has a period to predict with */
+	bool HasTempo() const {return m_Pulses >= 2;}
+
+	/** @brief Whether the period has settled */
+	bool Locked() const {return m_Locked;}
+
+	/** @brief Time from the first pulse (or from losing lock) to the last lock (negative if it has not locked) */
+	Nanoseconds LockTime() const {return m_LockTime;}
+
+	/** @brief Number of the last pulse in the song */
+	long long Pulse() const {return m_Pulse;}
+
+	/** @brief When the last pulse arrived */
+	TimePoint Arrival() const {return m_Arrival;}
+
+	/** @brief Arrival of the last pulse minus where the loop predicted it (nanoseconds) */
+	double Error() const {return m_Error;}
+
+	/** @brief Filtered nanoseconds per beat */
+	double BeatPeriod() const {return m_Period * PPQN;}
+
+	/** @brief Filtered time of pulse N of the song */
+	TimePoint PulseAt(long long N) const {
+		return TimePoint(Nanoseconds(std::llround(m_Time + m_Period * (double)(N - m_Pulse))));
+	}
+};
+
+/** @brief Where the beats of the grid fall in a MIDI song, counted in clock pulses
+ * MIDI clock counts quarter notes whatever the time signature, while a beat of the grid is a note of its lower
+ * value, so a beat is 4 * PPQN / NoteValue pulses (12 in 6/8, 48 in 3/2).  The map holds from beat From, which
+ * starts on pulse Pulse of the song; a change of time signature starts a new map where the old one got to (Then).
+ */
+struct MidiSongMap {
+	static constexpr int PPQN = MidiClockFollower::PPQN; ///<Clock pulses per quarter note
+	long long From = 1;  ///<First beat of the grid the map applies to
+	long long Pulse = 0; ///<Pulse of the song that beat From starts on
+	int PerBeat = PPQN;  ///<Pulses per beat
+
+	/** @brief Pulses per beat of a note value (at least 2, so a beat always has a middle) */
+	static int PulsesPerBeat(int NoteValue) {return std::max(4 * PPQN / std::max(NoteValue,1),2);}
+
+	/** @brief A song whose first beat is beat 1 of the grid */
+	static MidiSongMap Song(int NoteValue) {return MidiSongMap{1,0,PulsesPerBeat(NoteValue)};}
+
+	/** @brief The map from beat Beat on, where beats become NoteValue notes */
+	MidiSongMap Then(long long Beat, int NoteValue) const {return MidiSongMap{Beat,PulseAt((double)Beat),PulsesPerBeat(NoteValue)};}
+
+	/** @brief (Fractional) beat of the grid that pulse P of the song is on */
+	double BeatOf(long long P) const {return (double)From + (double)(P - Pulse) / (double)PerBeat;}
+
+	/** @brief Last pulse of the song at or before a (fractional) beat of the grid */
+	long long PulseAt(double Beat) const {return Pulse + (long long)std::floor((Beat - (double)From) * (double)PerBeat);}
+
+	/** @brief Pulses from the start of its beat to pulse P */
+	int Into(long long P) const {
+		long long R = (P - Pulse) % PerBeat;
+		return (int)(R < 0 ? R + PerBeat : R);
+	}
+};
+
+/** @brief Sends MIDI clock, start, stop and song position for a beat grid
+ * Pulse P is due at the beat of the grid the song map puts it on, so the clock follows tempo changes and ramps
+ * exactly as the beats do (and counts quarter notes whatever the time signature), and is sent by the thread that
+ * owns the grid at the moment it is due (see Next).  A pulse that is more than one late (after a stall) is
+ * skipped rather than sent in a burst that would upset the receiver's tempo.  The grid's downbeat, beat 1, is
+ * the first beat of the song.  Writes never block: a byte the port cannot take (eg: a FIFO nothing is reading)
+ * is dropped rather than delaying the clock.
+ */
+struct MidiClockSender {
+	using TimePoint = BeatScheduler::TimePoint;
+	static constexpr int PPQN = MidiClockFollower::PPQN; ///<Clock pulses per quarter note
+private:
+	MidiPort const *m_Port;   ///<Where the clock goes (non-owning; null to send nothing)
+	bool m_Sending = false;   ///<Whether the transport is running
+	long long m_Pulse = 0;    ///<Next pulse of the song to send
+	long long m_Skipped = 0;  ///<Pulses skipped because they were already late
+
+	void Write(unsigned char const *Bytes, std::size_t Count) {
+		if (::write(m_Port->FD(), Bytes, Count) < 0) {} //EAGAIN: the port is full, and a late clock is worse than none
+	}
+public:
+	explicit MidiClockSender(MidiPort const *Port = nullptr) : m_Port(Port) {}
+
+	/** @brief Start the transport so that the first pulse is on beat Beat of the grid (1 is the start of the song) */
+	void Start(MidiSongMap const &Song, long long Beat) {
+		if (!m_Port) return;
+		constexpr long long PerSixteenth = PPQN / 4;
+		long long Sixteenths = (std::max(Song.PulseAt((double)Beat),0LL) + PerSixteenth - 1) / PerSixteenth; //the song position is in sixteenths
+		if (Sixteenths > 0x3FFF) Sixteenths = 0x3FFF;
+		m_Pulse = Sixteenths * PerSixteenth;
+		unsigned char Bytes[4] = {MidiSongPosition,(unsigned char)(Sixteenths & 0x7F),(unsigned char)(Sixteenths >> 7),(unsigned char)(Sixteenths == 0 ? MidiStart : MidiContinue)};
+		Write(Bytes,sizeof(Bytes));
+		m_Sending = true;
+	}
+
+	/** @brief Stop the transport */
+	void Stop() {
+		if (!m_Port || !m_Sending) return;
+		unsigned char Byte = MidiStop;
+		Write(&Byte,1);
+		m_Sending = false;
+	}
+
+	/** @brief Next pulse of the song to send (to pick the song map it falls in) */
+	long long Pulse() const {return m_Pulse;}
+
+	/** @brief When the next pulse is due (TimePoint::max() if the transport is stopped) */
+	TimePoint Next(BeatScheduler const &Beats, MidiSongMap const &Song) const {
+		return m_Sending ? Beats.At(Song.BeatOf(m_Pulse)) : TimePoint::max();
+	}
+
+	/** @brief Send the pulse that is due at Now, if any */
+	void Send(BeatScheduler const &Beats, MidiSongMap const &Song, TimePoint Now) {
+		if (!m_Sending || Now < Next(Beats,Song)) return;
+		long long Latest = Song.PulseAt(Beats.Position(Now));
+		if (Latest > m_Pulse) { //never catch up in a burst
+			m_Skipped += Latest - m_Pulse;
+			m_Pulse = Latest;
+		}
+		unsigned char Byte = MidiClock;
+		Write(&Byte,1);
+		Metrics().MidiClockLateness.Record(Now - Beats.At(Song.BeatOf(m_Pulse)));
+		m_Pulse += 1;
+	}
+
+	/** @brief Pulses skipped because they were already late */
+	long long Skipped() const {return m_Skipped;}
+};
+
+#endif
@@ -0,0 +1,112 @@
+#ifndef PENDULUM_HPP_
+#define PENDULUM_HPP_
+
+/** @file Pendulum visualization
+ * @brief A metronome pendulum rasterized once per phase position and replayed from a cache
+ */
+
+#include "Interface.hpp"
+#include "Framebuffer.hpp"
+#include "Formulas.hpp"
+#include "Types.hpp"
+
+#include <algorithm> //min, max
+#include <chrono>    //std::chrono
+#include <cmath>     //sin, cos, ceil
+#include <vector>    //vector
+
+/** @brief Swing frames of a pendulum for one window size, tempo and colour
+ * The pendulum sits at an extreme on every beat and crosses the centre halfway between beats.  One swing
+ * (extreme to extreme) is sampled at Phases() positions; the return swing plays the same frames backwards.
+ * Drawing a frame is a lookup plus a sprite blit, so no trigonometry or rasterizing happens per frame.
+ */
+struct PendulumCache {
+	static constexpr float MaxAngle = 0.5f;       ///<Swing either side of vertical (radians)
+	static constexpr float CellAspect = 2.0f;     ///<Height of a character cell over its width
+	static constexpr double FramesPerSecond = 60; ///<Phase positions are sampled at this rate...
+	static constexpr int MinPhases = 8;           ///<...but never more coarsely than this per swing
+	static constexpr int MaxPhases = 120;         ///<...nor more finely than this per swing
+private:
+	/** @brief What the cached frames were rendered for */
+	struct Key {
+		BoxSize<int> Size {0,0};
+		float BPM = 0;
+		int Color = -1;
+		bool operator==(Key const &O) const {return Size.X == O.Size.X && Size.Y == O.Size.Y && BPM == O.BPM && Color == O.Color;}
+	};
+	Key m_Key;
+	std::vector<CellSprite> m_Frames; ///<One sprite per phase position (capacity is kept between rebuilds)
+	int m_Phases = 0;
+
+	/** @brief Draw the pendulum at an angle from vertical */
+	template <typename Window>
+	static void DrawAt(Window &Win, BoxSize<int> Size, float Angle, unsigned char Color) {
+		float Height = (float)Size.Y;
+		Position<float> Pivot {(float)Size.X / 2.0f, Height - 2.0f};
+		float Length = (Height - 3.0f) * 0.9f;
+		Position<float> Tip {Pivot.X + Length * std::sin(Angle) * CellAspect, Pivot.Y - Length * std::cos(Angle)};
+		Position<float> Bob {Pivot.X + (Tip.X - Pivot.X) * 0.7f, Pivot.Y + (Tip.Y - Pivot.Y) * 0.7f};
+		float BodyHalfWidth = Height * 0.4f;
+		//body, rod (drawn in the body's white border colour), then the sliding weight
+		Win.DrawTriangle({-BodyHalfWidth,Height - 1.0f},{BodyHalfWidth,Height - 1.0f},{0.0f,Height * 0.6f},{9,0,0,255},1.0f,{Pivot.X,0.0f},true,{Color,0,0,60});
+		Win.DrawLine(Pivot,Tip,1.0f);
+		Win.DrawCircle(std::max(1.0f,Height / 10.0f),Bob,{9,0,0,255},1.0f,true,{Color,0,0,255});
+	}
+public:
+	/** @brief Number of phase positions per swing for a tempo */
+	static int PhasesFor(float BPM) {
+		double Seconds = ComputeNanosecondsPerBeat((double)BPM) / 1e9;
+		return std::max(MinPhases,std::min((int)std::ceil(Seconds * FramesPerSecond),MaxPhases));
+	}
+
+	/** @brief Number of cached phase positions per swing */
+	int Phases() const {return m_Phases;}
+
+	/** @brief Whether the cache was built for these parameters */
+	bool Matches(BoxSize<int> Size, float BPM, int Color) const {return m_Key == Key{Size,BPM,Color};}
+
+	/** @brief Forget the cached frames (eg: after a change in resolution) */
+	void Invalidate() {m_Key = Key();}
+
+	/** @brief Rasterize every phase position; the window is left filled with the empty background */
+	template <typename Window>
+	void Build(Window &Win, float BPM, unsigned char Color) {
+		BoxSize<int> Size = Win.GetSize();
+		m_Phases = PhasesFor(BPM);
+		m_Frames.resize((std::size_t)m_Phases);
+		for (int i = 0; i != m_Phases; i++) {
+			//sample the centre of each phase interval so that the return swing mirrors exactly
+			float Phase = ((float)i + 0.5f) / (float)m_Phases;
+			Win.FillScreen({0,0,0,0});
+			DrawAt(Win,Size,MaxAngle * std::cos(Phase * 3.14159265f),Color);
+			Win.CaptureSprite(m_Frames[(std::size_t)i]);
+		}
+		Win.FillScreen({0,0,0,0});
+		m_Key = Key{Size,BPM,(int)Color};
+	}
+
+	/** @brief Frame index for a point in time
+	 * @param SinceBeat  Time since the last beat
+	 * @param Beat       Index of the last beat (odd beats swing one way, even beats the other)
+	 */
+	int FrameAt(std::chrono::nanoseconds SinceBeat, unsigned long long Beat, float BPM) const {
+		double Phase = (double)SinceBeat.count() / ComputeNanosecondsPerBeat((double)BPM);
+		int Index = std::max(0,std::min((int)(Phase * m_Phases),m_Phases - 1));
+		return (Beat & 1) ? Index : m_Phases - 1 - Index;
+	}
+
+	/** @brief Frame shown while the clock is stopped (standing upright in the middle of the swing) */
+	int RestingFrame() const {return m_Phases / 2;}
+
+	/** @brief Time after the last beat at which the frame next changes (no later than the next beat) */
+	std::chrono::nanoseconds NextChange(std::chrono::nanoseconds SinceBeat, float BPM) const {
+		double Period = ComputeNanosecondsPerBeat((double)BPM);
+		double Step = Period / (double)std::max(m_Phases,1);
+		double Next = (std::floor((double)SinceBeat.count() / Step) + 1.0) * Step;
+		return std::chrono::nanoseconds((long long)std::min(Next,Period));
+	}
+
+	CellSprite const &Frame(int Index) const {return m_Frames[(std::size_t)Index];}
+};
+
+#endif
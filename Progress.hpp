@@ -0,0 +1,90 @@
+#ifndef PROGRESS_HPP_
+#define PROGRESS_HPP_
+
+/** @file Progress visualization
+ * @brief A bar that sweeps across the window once per beat, drawing only the band it advanced by
+ */
+
+#include "Interface.hpp"
+#include "Types.hpp"
+
+#include <algorithm> //min, max
+#include <cmath>     //floor
+
+/** @brief Progress bar sweeping in one of four directions
+ * Odd beats sweep the colour in, even beats sweep it back out in the same direction, so the start of a beat
+ * never has to clear the whole bar.  Each Advance() draws only the band between the extent already drawn and
+ * the new one, so the cells that change per frame are proportional to the progress made, not the window area.
+ */
+struct ProgressBar {
+private:
+	float m_Drawn = 0.0f;   ///<Extent drawn in the current sweep (cells along the direction of travel)
+	bool m_Filling = true;  ///<Whether the current sweep draws the colour (or the background)
+
+	/** @brief Length of the bar (inside the border) */
+	static float Length(Visualization Direction, BoxSize<int> Size) {
+		bool Vertical = (Direction == Visualization::ProgressTopDown || Direction == Visualization::ProgressBottomUp);
+		return (float)std::max((Vertical ? Size.Y : Size.X) - 2,0);
+	}
+
+	/** @brief Fill the band between two extents */
+	template <typename Window>
+	static void Band(Window &Win, Visualization Direction, BoxSize<int> Size, float From, float To, ColorType<unsigned char> Color) {
+		if (To <= From) return;
+		float W = (float)Size.X, H = (float)Size.Y;
+		switch (Direction) {
+		case Visualization::ProgressTopDown:     Win.DrawRect({1.0f,1.0f + From},{W - 1.0f,1.0f + To},Color); break;
+		case Visualization::ProgressBottomUp:    Win.DrawRect({1.0f,H - 1.0f - To},{W - 1.0f,H - 1.0f - From},Color); break;
+		case Visualization::ProgressLeftToRight: Win.DrawRect({1.0f + From,1.0f},{1.0f + To,H - 1.0f},Color); break;
+		case Visualization::ProgressRightToLeft: Win.DrawRect({W - 1.0f - To,1.0f},{W - 1.0f - From,H - 1.0f},Color); break;
+		default: break;
+		}
+	}
+public:
+	/** @brief Whether a visualization is one of the progress bars */
+	static bool IsProgress(Visualization V) {
+		return V == Visualization::ProgressTopDown || V == Visualization::ProgressBottomUp ||
+		       V == Visualization::ProgressLeftToRight || V == Visualization::ProgressRightToLeft;
+	}
+
+	/** @brief Start a new sweep (drawing the colour in, or taking it back out) */
+	void Start(bool Filling) {
+		m_Drawn = 0.0f;
+		m_Filling = Filling;
+	}
+
+	/** @brief Keep the current sweep at the same fraction of the bar after the window changed size */
+	void Resize(Visualization Direction, BoxSize<int> From, BoxSize<int> To) {
+		float Old = Length(Direction,From);
+		m_Drawn = (Old > 0.0f) ? m_Drawn / Old * Length(Direction,To) : 0.0f;
+	}
+
+	/** @brief Extend the current sweep to a fraction of the bar, drawing only the newly covered band */
+	template <typename Window>
+	void Advance(Window &Win, Visualization Direction, float Fraction, unsigned char Color) {
+		BoxSize<int> Size = Win.GetSize();
+		float To = std::max(0.0f,std::min(Fraction,1.0f)) * Length(Direction,Size);
+		Band(Win,Direction,Size,m_Drawn,To,m_Filling ? ColorType<unsigned char>{Color,0,0,255} : ColorType<unsigned char>{0,0,0,0});
+		m_Drawn = std::max(m_Drawn,To);
+	}
+
+	/** @brief Draw the whole bar again (after the window was filled) */
+	template <typename Window>
+	void Repaint(Window &Win, Visualization Direction, unsigned char Color) {
+		BoxSize<int> Size = Win.GetSize();
+		float L = Length(Direction,Size);
+		if (m_Filling) Band(Win,Direction,Size,0.0f,m_Drawn,{Color,0,0,255});
+		else Band(Win,Direction,Size,m_Drawn,L,{Color,0,0,255});
+	}
+
+	/** @brief Time (as a fraction of the beat) at which the bar next reaches a new cell boundary
+	 * @param Steps  Boundaries per cell (more than one for sub-cell resolutions)
+	 */
+	float NextStep(Visualization Direction, BoxSize<int> Size, float Fraction, int Steps) const {
+		float Units = Length(Direction,Size) * (float)Steps;
+		if (Units <= 0.0f) return 1.0f;
+		return std::min((std::floor(Fraction * Units) + 1.0f) / Units,1.0f);
+	}
+};
+
+#endif
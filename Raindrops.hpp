@@ -0,0 +1,135 @@
+#ifndef RAINDROPS_HPP_
+#define RAINDROPS_HPP_
+
+/** @file Raindrops visualization
+ * @brief Particle system whose drops are timed to land on the next beat
+ */
+
+#include "Interface.hpp"
+#include "Types.hpp"
+
+#include <array>     //array
+#include <chrono>    //std::chrono
+#include <cstddef>   //size_t
+#include <cstdint>   //uint32_t
+
+/** @brief Fixed-capacity particle pool stored as structure-of-arrays
+ * Each attribute is a contiguous float array so the update loop is a handful of independent streams the
+ * compiler can vectorize.  Dead particles are swap-removed, keeping the live ones packed at the front.
+ * No memory is allocated after construction.
+ */
+template <std::size_t Capacity>
+struct ParticlePool {
+	alignas(64) std::array<float,Capacity> X;    ///<Position across the window (cells)
+	alignas(64) std::array<float,Capacity> Y;    ///<Position down the window (cells)
+	alignas(64) std::array<float,Capacity> VX;   ///<Velocity (cells per second)
+	alignas(64) std::array<float,Capacity> VY;   ///<Velocity (cells per second)
+	alignas(64) std::array<float,Capacity> Age;  ///<Seconds since spawning
+	alignas(64) std::array<float,Capacity> Life; ///<Seconds until the particle lands
+	std::size_t Count = 0;                       ///<Number of live particles (the first Count entries)
+
+	static constexpr std::size_t MaxParticles() {return Capacity;}
+
+	/** @brief Add a particle; returns false if the pool is full */
+	bool Spawn(float PX, float PY, float PVX, float PVY, float PLife) {
+		if (Count == Capacity) return false;
+		X[Count] = PX; Y[Count] = PY;
+		VX[Count] = PVX; VY[Count] = PVY;
+		Age[Count] = 0.0f; Life[Count] = PLife;
+		Count += 1;
+		return true;
+	}
+
+	/** @brief Advance every particle by DT seconds and remove the ones that have landed */
+	void Update(float DT) {
+		float *PX = X.data(), *PY = Y.data(), *PA = Age.data();
+		float const *PVX = VX.data(), *PVY = VY.data();
+		for (std::size_t i = 0; i != Count; i++) { //branch-free: vectorizes
+			PX[i] += PVX[i] * DT;
+			PY[i] += PVY[i] * DT;
+			PA[i] += DT;
+		}
+		for (std::size_t i = 0; i < Count;) {
+			if (Age[i] < Life[i]) {i++; continue;}
+			Count -= 1;
+			X[i] = X[Count]; Y[i] = Y[Count];
+			VX[i] = VX[Count]; VY[i] = VY[Count];
+			Age[i] = Age[Count]; Life[i] = Life[Count];
+		}
+	}
+
+	void Clear() {Count = 0;}
+};
+
+/** @brief Raindrops falling in one of four directions, spawned in waves that land exactly on a beat
+ * Every drop of a wave starts somewhere up to one window length before the entry edge and gets the speed
+ * that carries it to the far edge at the target deadline, so the wave lands together however staggered it
+ * starts.  Drops are drawn as a bright head with a dimmer tail one frame behind it.
+ */
+struct RainSystem {
+	static constexpr std::size_t Capacity = 8192; ///<Maximum live drops
+	static constexpr float DropsPerCell = 0.5f;   ///<Drops per wave for each cell of the entry edge
+	static constexpr float TrailSeconds = 1.0f / 30.0f; ///<Length of a drop's tail in time
+private:
+	ParticlePool<Capacity> m_Drops;
+	std::array<float,Capacity> m_TailX; ///<Scratch for tail positions
+	std::array<float,Capacity> m_TailY; ///<Scratch for tail positions
+	uint32_t m_Seed = 0x9E3779B9u;      ///<xorshift state
+
+	/** @brief Uniform random number in [0,1) */
+	float Random() {
+		m_Seed ^= m_Seed << 13;
+		m_Seed ^= m_Seed >> 17;
+		m_Seed ^= m_Seed << 5;
+		return (float)(m_Seed >> 8) * (1.0f / 16777216.0f);
+	}
+public:
+	/** @brief Number of live drops */
+	std::size_t Count() const {return m_Drops.Count;}
+
+	/** @brief Remove every drop */
+	void Clear() {m_Drops.Clear();}
+
+	/** @brief Spawn a wave of drops that land on the far edge after Until
+	 * @param Direction  One of the Particles* visualizations
+	 * @param Size       Window size in cells
+	 * @param Until      Time left until the beat the wave should land on
+	 */
+	void SpawnWave(Visualization Direction, BoxSize<int> Size, std::chrono::nanoseconds Until) {
+		float Seconds = (float)std::chrono::duration<double>(Until).count();
+		if (Seconds <= 0.0f || Size.X < 3 || Size.Y < 3) return;
+		bool Vertical = (Direction == Visualization::ParticlesTopDown || Direction == Visualization::ParticlesBottomUp);
+		bool Forward = (Direction == Visualization::ParticlesTopDown || Direction == Visualization::ParticlesLeftToRight);
+		float Length = (float)(Vertical ? Size.Y : Size.X) - 1.5f; //travel axis, landing just inside the far border
+		float Across = (float)(Vertical ? Size.X : Size.Y) - 2.0f;  //entry edge, inside the border
+		int Drops = (int)(Across * DropsPerCell);
+		for (int i = 0; i != Drops; i++) {
+			float Start = -Random() * Length;     //distance before the entry edge
+			float Speed = (Length - Start) / Seconds;
+			float Along = Forward ? Start : (float)(Vertical ? Size.Y : Size.X) - Start;
+			float Side = 1.0f + Random() * Across;
+			float V = Forward ? Speed : -Speed;
+			bool Added = Vertical ? m_Drops.Spawn(Side,Along,0.0f,V,Seconds) : m_Drops.Spawn(Along,Side,V,0.0f,Seconds);
+			if (!Added) break;
+		}
+	}
+
+	/** @brief Move the drops forward in time */
+	void Update(std::chrono::nanoseconds DT) {
+		m_Drops.Update((float)std::chrono::duration<double>(DT).count());
+	}
+
+	/** @brief Draw every drop (tail first so heads stay on top) */
+	template <typename Window>
+	void Draw(Window &Win, unsigned char Color) {
+		std::size_t N = m_Drops.Count;
+		for (std::size_t i = 0; i != N; i++) {
+			m_TailX[i] = m_Drops.X[i] - m_Drops.VX[i] * TrailSeconds;
+			m_TailY[i] = m_Drops.Y[i] - m_Drops.VY[i] * TrailSeconds;
+		}
+		Win.DrawPoints(m_TailX.data(),m_TailY.data(),N,{Color,0,0,110});
+		Win.DrawPoints(m_Drops.X.data(),m_Drops.Y.data(),N,{9,0,0,255});
+	}
+};
+
+#endif
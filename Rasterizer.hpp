@@ -0,0 +1,163 @@
+#ifndef RASTERIZER_HPP_
+#define RASTERIZER_HPP_
+
+/** @file Cell rasterizer
+ * @brief Draws lines, triangles and circles into a CellFramebuffer
+ * Coordinates are in cells (X = column, Y = row) and a cell is covered when its centre is.  Every
+ * primitive is clipped to its bounding box against the buffer before any per-cell work is done.
+ * Any target with Width(), Height(), Set(Y,X,G,A) and FillRow(Y,X0,X1,G,A) can be drawn into (eg: a SubCellCanvas).
+ */
+
+#include "Framebuffer.hpp"
+#include "Types.hpp"
+
+#include <algorithm> //min, max
+#include <cmath>     //floor, ceil, lround
+#include <cstdlib>   //abs
+#include <vector>    //vector
+
+/** @brief Software rasterizer for cell buffers (keeps scratch space so steady-state drawing does not allocate) */
+struct Rasterizer {
+	using Glyph = CellFramebuffer::Glyph;
+	using Attr = CellFramebuffer::Attr;
+private:
+	std::vector<int> m_Outer; ///<Half-widths of the outer circle per row offset
+	std::vector<int> m_Inner; ///<Half-widths of the inner circle per row offset
+
+	/** @brief Half-width of a circle of radius R for every row offset 0..R (midpoint circle algorithm) */
+	static void CircleHalfWidths(int R, std::vector<int> &HalfWidth) {
+		HalfWidth.assign((std::size_t)R + 1,0);
+		int X = 0, Y = R, D = 1 - R;
+		while (X <= Y) {
+			//each step yields the 8 symmetric points (±X,±Y) and (±Y,±X)
+			HalfWidth[Y] = std::max(HalfWidth[Y],X);
+			HalfWidth[X] = std::max(HalfWidth[X],Y);
+			if (D < 0) {
+				D += 2 * X + 3;
+			} else {
+				D += 2 * (X - Y) + 5;
+				Y -= 1;
+			}
+			X += 1;
+		}
+		for (int i = R - 1; i >= 0; i--) HalfWidth[i] = std::max(HalfWidth[i],HalfWidth[i+1]); //fill gaps in steep sections
+	}
+
+	/** @brief Twice the signed area of (A,B,P) */
+	static float Edge(Position<float> const &A, Position<float> const &B, float PX, float PY) {
+		return (B.X - A.X) * (PY - A.Y) - (B.Y - A.Y) * (PX - A.X);
+	}
+public:
+	/** @brief Draw a line with Bresenham's algorithm; thick lines are drawn as a filled quad */
+	template <typename Target>
+	void Line(Target &F, Position<float> P1, Position<float> P2, float Thickness, Glyph G, Attr A) {
+		if (Thickness > 1.5f) {
+			LengthVector<float> N = LengthVector<float>(P1,P2).Normal();
+			N.Normalize();
+			float H = Thickness / 2.0f;
+			Position<float> C1 {P1.X + N.X * H, P1.Y + N.Y * H};
+			Position<float> C2 {P2.X + N.X * H, P2.Y + N.Y * H};
+			Position<float> C3 {P2.X - N.X * H, P2.Y - N.Y * H};
+			Position<float> C4 {P1.X - N.X * H, P1.Y - N.Y * H};
+			FillTriangle(F,C1,C2,C3,G,A);
+			FillTriangle(F,C1,C3,C4,G,A);
+			return;
+		}
+		int X0 = (int)std::floor(P1.X), Y0 = (int)std::floor(P1.Y);
+		int X1 = (int)std::floor(P2.X), Y1 = (int)std::floor(P2.Y);
+		//trivially reject lines entirely outside the buffer
+		if ((X0 < 0 && X1 < 0) || (Y0 < 0 && Y1 < 0) || (X0 >= F.Width() && X1 >= F.Width()) || (Y0 >= F.Height() && Y1 >= F.Height())) return;
+		int DX = std::abs(X1 - X0), SX = X0 < X1 ? 1 : -1;
+		int DY = -std::abs(Y1 - Y0), SY = Y0 < Y1 ? 1 : -1;
+		int Err = DX + DY;
+		while (true) {
+			F.Set(Y0,X0,G,A);
+			if (X0 == X1 && Y0 == Y1) break;
+			int E2 = 2 * Err;
+			if (E2 >= DY) {Err += DY; X0 += SX;}
+			if (E2 <= DX) {Err += DX; Y0 += SY;}
+		}
+	}
+
+	/** @brief Fill a triangle using incremental edge functions over its clipped bounding box */
+	template <typename Target>
+	void FillTriangle(Target &F, Position<float> P1, Position<float> P2, Position<float> P3, Glyph G, Attr A) {
+		float Area = Edge(P1,P2,P3.X,P3.Y);
+		if (Area == 0.0f) return;
+		if (Area < 0.0f) std::swap(P2,P3); //make the winding counter-clockwise so inside is positive
+		int MinX = std::max((int)std::floor(std::min({P1.X,P2.X,P3.X})),0);
+		int MaxX = std::min((int)std::ceil(std::max({P1.X,P2.X,P3.X})),F.Width() - 1);
+		int MinY = std::max((int)std::floor(std::min({P1.Y,P2.Y,P3.Y})),0);
+		int MaxY = std::min((int)std::ceil(std::max({P1.Y,P2.Y,P3.Y})),F.Height() - 1);
+		if (MinX > MaxX || MinY > MaxY) return;
+		//per-column increments of each edge function
+		float A0 = -(P3.Y - P2.Y), A1 = -(P1.Y - P3.Y), A2 = -(P2.Y - P1.Y);
+		float B0 = (P3.X - P2.X), B1 = (P1.X - P3.X), B2 = (P2.X - P1.X);
+		float CX = (float)MinX + 0.5f, CY = (float)MinY + 0.5f;
+		float W0Row = Edge(P2,P3,CX,CY), W1Row = Edge(P3,P1,CX,CY), W2Row = Edge(P1,P2,CX,CY);
+		for (int Y = MinY; Y <= MaxY; Y++) {
+			float W0 = W0Row, W1 = W1Row, W2 = W2Row;
+			int SpanStart = -1;
+			for (int X = MinX; X <= MaxX; X++) {
+				bool Inside = (W0 >= 0.0f) && (W1 >= 0.0f) && (W2 >= 0.0f);
+				if (Inside && SpanStart < 0) SpanStart = X;
+				else if (!Inside && SpanStart >= 0) break; //a triangle covers one contiguous span per row
+				W0 += A0; W1 += A1; W2 += A2;
+			}
+			if (SpanStart >= 0) {
+				int SpanEnd = SpanStart;
+				float E0 = W0Row + A0 * (float)(SpanStart - MinX), E1 = W1Row + A1 * (float)(SpanStart - MinX), E2 = W2Row + A2 * (float)(SpanStart - MinX);
+				while (SpanEnd <= MaxX && E0 >= 0.0f && E1 >= 0.0f && E2 >= 0.0f) {SpanEnd++; E0 += A0; E1 += A1; E2 += A2;}
+				F.FillRow(Y,SpanStart,SpanEnd,G,A);
+			}
+			W0Row += B0; W1Row += B1; W2Row += B2;
+		}
+	}
+
+	/** @brief Outline a triangle */
+	template <typename Target>
+	void TriangleOutline(Target &F, Position<float> P1, Position<float> P2, Position<float> P3, float Thickness, Glyph G, Attr A) {
+		Line(F,P1,P2,Thickness,G,A);
+		Line(F,P2,P3,Thickness,G,A);
+		Line(F,P3,P1,Thickness,G,A);
+	}
+
+	/** @brief Fill a disc row by row from its midpoint-circle half-widths */
+	template <typename Target>
+	void FillCircle(Target &F, Position<float> Centre, float Radius, Glyph G, Attr A) {
+		int R = (int)std::lround(Radius);
+		if (R < 0) return;
+		int CX = (int)std::floor(Centre.X), CY = (int)std::floor(Centre.Y);
+		if (CX + R < 0 || CX - R >= F.Width() || CY + R < 0 || CY - R >= F.Height()) return;
+		CircleHalfWidths(R,m_Outer);
+		for (int DY = std::max(-R,-CY); DY <= std::min(R,F.Height() - 1 - CY); DY++) {
+			int H = m_Outer[(std::size_t)std::abs(DY)];
+			F.FillRow(CY + DY,CX - H,CX + H + 1,G,A);
+		}
+	}
+
+	/** @brief Draw a ring of the given thickness inside radius Radius */
+	template <typename Target>
+	void CircleOutline(Target &F, Position<float> Centre, float Radius, float Thickness, Glyph G, Attr A) {
+		int R = (int)std::lround(Radius);
+		int RIn = R - std::max((int)std::lround(Thickness),1);
+		if (R < 0) return;
+		if (RIn < 0) {FillCircle(F,Centre,Radius,G,A); return;}
+		int CX = (int)std::floor(Centre.X), CY = (int)std::floor(Centre.Y);
+		if (CX + R < 0 || CX - R >= F.Width() || CY + R < 0 || CY - R >= F.Height()) return;
+		CircleHalfWidths(R,m_Outer);
+		CircleHalfWidths(RIn,m_Inner);
+		for (int DY = std::max(-R,-CY); DY <= std::min(R,F.Height() - 1 - CY); DY++) {
+			int Outer = m_Outer[(std::size_t)std::abs(DY)];
+			if (std::abs(DY) > RIn) {
+				F.FillRow(CY + DY,CX - Outer,CX + Outer + 1,G,A);
+			} else {
+				int Inner = m_Inner[(std::size_t)std::abs(DY)];
+				F.FillRow(CY + DY,CX - Outer,CX - Inner,G,A);
+				F.FillRow(CY + DY,CX + Inner + 1,CX + Outer + 1,G,A);
+			}
+		}
+	}
+};
+
+#endif
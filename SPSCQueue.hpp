@@ -0,0 +1,50 @@
+#ifndef SPSC_QUEUE_HPP_
+#define SPSC_QUEUE_HPP_
+
+/** @file Lock-free queue
+ * @brief Bounded single-producer/single-consumer ring buffer for passing events between threads
+ */
+
+#include <array>       //array
+#include <atomic>      //atomic
+#include <cstddef>     //size_t
+#include <type_traits> //is_trivially_copyable
+
+/** @brief Fixed-capacity lock-free SPSC queue
+ * Exactly one thread may Push and exactly one (other) thread may Pop.  Neither side ever blocks
+ * or allocates, so it is safe to use from a real-time thread.
+ */
+template <typename T, std::size_t Capacity>
+struct SPSCQueue {
+	static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+	static_assert(std::is_trivially_copyable<T>::value, "Queue elements are copied between threads");
+private:
+	std::array<T,Capacity> m_Buffer;          ///<Element storage
+	alignas(64) std::atomic<std::size_t> m_Head {0}; ///<Next slot to read (owned by consumer)
+	alignas(64) std::atomic<std::size_t> m_Tail {0}; ///<Next slot to write (owned by producer)
+public:
+	/** @brief Add an element; returns false (and drops it) if the queue is full */
+	bool Push(T const &Item) {
+		std::size_t Tail = m_Tail.load(std::memory_order_relaxed);
+		if (Tail - m_Head.load(std::memory_order_acquire) == Capacity) return false;
+		m_Buffer[Tail & (Capacity - 1)] = Item;
+		m_Tail.store(Tail + 1, std::memory_order_release);
+		return true;
+	}
+
+	/** @brief Remove the oldest element; returns false if the queue is empty */
+	bool Pop(T &Item) {
+		std::size_t Head = m_Head.load(std::memory_order_relaxed);
+		if (Head == m_Tail.load(std::memory_order_acquire)) return false;
+		Item = m_Buffer[Head & (Capacity - 1)];
+		m_Head.store(Head + 1, std::memory_order_release);
+		return true;
+	}
+
+	/** @brief Whether the queue currently looks empty (only exact from the consumer side) */
+	bool Empty() const {
+		return m_Head.load(std::memory_order_acquire) == m_Tail.load(std::memory_order_acquire);
+	}
+};
+
+#endif
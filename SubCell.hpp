@@ -0,0 +1,138 @@
+#ifndef SUBCELL_HPP_
+#define SUBCELL_HPP_
+
+/** @file Sub-cell rendering
+ * @brief A pixel canvas at 1x2 or 2x4 pixels per cell that is packed into half-block or Braille glyphs
+ */
+
+#include "Framebuffer.hpp"
+#include "Types.hpp"
+
+#include <algorithm> //fill, min, max
+#include <array>   //array
+#include <cstdint> //uint8_t
+#include <vector>  //vector
+
+/** @brief Build the 256-entry Braille table: pixel index (Y * 2 + X) to dot bit offset from U+2800 */
+constexpr std::array<uint32_t,256> MakeBrailleGlyphs() {
+	constexpr int Dot[8] = {0, 3, 1, 4, 2, 5, 6, 7}; //dots 1,4 / 2,5 / 3,6 / 7,8 by row
+	std::array<uint32_t,256> ret {};
+	for (unsigned Mask = 0; Mask != 256; Mask++) {
+		uint32_t Dots = 0;
+		for (int Bit = 0; Bit != 8; Bit++) {
+			if (Mask & (1u << Bit)) Dots |= 1u << Dot[Bit];
+		}
+		ret[Mask] = (Mask == 0) ? (uint32_t)' ' : 0x2800 + Dots;
+	}
+	return ret;
+}
+
+/** @brief Glyph lookup tables for packing pixel masks, built at compile time
+ * A cell's mask has bit (Y * PixelsX + X) set for each lit pixel (X,Y) inside the cell.
+ */
+struct SubCellGlyphs {
+	/** @brief Half blocks: bit 0 = upper pixel, bit 1 = lower pixel */
+	static constexpr std::array<uint32_t,4> HalfBlock {' ', 0x2580, 0x2584, 0x2588}; //' ', ▀, ▄, █
+	/** @brief Braille patterns for 2x4 pixels */
+	static constexpr std::array<uint32_t,256> Braille = MakeBrailleGlyphs();
+};
+
+static_assert(SubCellGlyphs::Braille[0xFF] == 0x28FF, "all eight dots");
+static_assert(SubCellGlyphs::Braille[0x01] == 0x2801, "top-left pixel is dot 1");
+static_assert(SubCellGlyphs::Braille[0x40] == 0x2840, "bottom-left pixel is dot 7");
+
+/** @brief Pixel canvas covering a cell window at sub-cell resolution
+ * The rasterizer draws into it like any other target (Width/Height/Set/FillRow in pixels).  Each cell keeps
+ * a pixel mask and the colour last drawn into it; Pack() turns touched cells into glyphs.
+ */
+struct SubCellCanvas {
+	using Glyph = CellFramebuffer::Glyph;
+	using Attr = CellFramebuffer::Attr;
+private:
+	static constexpr Attr Untouched = 0xFFFFFFFF; ///<Ink of cells nothing has been drawn into
+
+	SubCellMode m_Mode = SubCellMode::Cell;
+	int m_PixelsX = 1;          ///<Pixels per cell horizontally
+	int m_PixelsY = 1;          ///<Pixels per cell vertically
+	int m_Columns = 0;          ///<Width in cells
+	int m_Rows = 0;             ///<Height in cells
+	std::vector<uint8_t> m_Mask; ///<Lit pixels per cell
+	std::vector<Attr> m_Ink;     ///<Colour per cell (Untouched if nothing was drawn)
+	bool m_Dirty = false;        ///<Whether anything was drawn since the last Pack()
+
+	std::size_t Cell(int Y, int X) const {return (std::size_t)(Y / m_PixelsY) * (std::size_t)m_Columns + (std::size_t)(X / m_PixelsX);}
+	uint8_t Bit(int Y, int X) const {return (uint8_t)(1u << ((Y % m_PixelsY) * m_PixelsX + (X % m_PixelsX)));}
+public:
+	/** @brief Change the resolution and size (in cells); clears the canvas */
+	void Resize(SubCellMode Mode, int Columns, int Rows) {
+		m_Mode = Mode;
+		m_PixelsX = (Mode == SubCellMode::Braille) ? 2 : 1;
+		m_PixelsY = (Mode == SubCellMode::Braille) ? 4 : (Mode == SubCellMode::HalfBlock) ? 2 : 1;
+		m_Columns = Columns;
+		m_Rows = Rows;
+		m_Mask.assign((std::size_t)Columns * (std::size_t)Rows,0);
+		m_Ink.assign(m_Mask.size(),Untouched);
+		m_Dirty = false;
+	}
+
+	SubCellMode Mode() const {return m_Mode;}
+	/** @brief Width in pixels */
+	int Width() const {return m_Columns * m_PixelsX;}
+	/** @brief Height in pixels */
+	int Height() const {return m_Rows * m_PixelsY;}
+	/** @brief Pixels per cell horizontally */
+	int PixelsX() const {return m_PixelsX;}
+	/** @brief Pixels per cell vertically */
+	int PixelsY() const {return m_PixelsY;}
+
+	/** @brief Forget everything drawn */
+	void Clear() {
+		std::fill(m_Mask.begin(),m_Mask.end(),0);
+		std::fill(m_Ink.begin(),m_Ink.end(),Untouched);
+		m_Dirty = false;
+	}
+
+	/** @brief Light one pixel; a blank uncoloured cell (' ',0) erases it instead */
+	void Set(int Y, int X, Glyph G, Attr A) {
+		if (Y < 0 || X < 0 || Y >= Height() || X >= Width()) return;
+		std::size_t C = Cell(Y,X);
+		if (G == ' ' && A == 0) m_Mask[C] &= (uint8_t)~Bit(Y,X);
+		else m_Mask[C] |= Bit(Y,X);
+		m_Ink[C] = A;
+		m_Dirty = true;
+	}
+
+	/** @brief Light the pixels [X0,X1) of row Y (clipped) */
+	void FillRow(int Y, int X0, int X1, Glyph G, Attr A) {
+		if (Y < 0 || Y >= Height()) return;
+		X0 = std::max(X0,0);
+		X1 = std::min(X1,Width());
+		for (int X = X0; X < X1; X++) Set(Y,X,G,A);
+	}
+
+	/** @brief Write every touched cell into a framebuffer of the same size (in cells)
+	 * Partly lit cells take the colour-on-black pair of their ink so the unlit part shows the background.
+	 * @param BackgroundGlyph  Glyph for touched cells with no pixels left lit
+	 * @param BackgroundAttr   Attribute for touched cells with no pixels left lit
+	 */
+	void Pack(CellFramebuffer &F, Glyph BackgroundGlyph, Attr BackgroundAttr) {
+		if (!m_Dirty) return;
+		m_Dirty = false;
+		uint8_t Full = (uint8_t)((1u << (m_PixelsX * m_PixelsY)) - 1);
+		for (int Y = 0; Y != m_Rows; Y++) {
+			for (int X = 0; X != m_Columns; X++) {
+				std::size_t C = (std::size_t)Y * (std::size_t)m_Columns + (std::size_t)X;
+				if (m_Ink[C] == Untouched) continue;
+				uint8_t Mask = m_Mask[C];
+				if (Mask == 0) {F.Set(Y,X,BackgroundGlyph,BackgroundAttr); continue;}
+				Attr A = m_Ink[C];
+				Attr Pair = A & CellAttr::ColorMask;
+				if (Mask != Full && Pair >= 2 && Pair < 10) A += 10; //solid pairs would hide the glyph
+				Glyph G = (m_Mode == SubCellMode::Braille) ? SubCellGlyphs::Braille[Mask] : SubCellGlyphs::HalfBlock[Mask & 3];
+				F.Set(Y,X,G,A);
+			}
+		}
+	}
+};
+
+#endif
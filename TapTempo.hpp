@@ -0,0 +1,122 @@
+#ifndef TAP_TEMPO_HPP_
+#define TAP_TEMPO_HPP_
+
+/** @file Tap tempo
+ * @brief Estimates the tempo from taps on a key, in constant time and without allocating
+ */
+
+#include <algorithm> //nth_element
+#include <array>     //array
+#include <chrono>    //std::chrono
+#include <cmath>     //abs, round
+#include <cstddef>   //size_t
+
+/** @brief Robust fit of the beat length to the last few taps
+ * The median gap between the last Window taps gives a rough beat length that a stray tap (which splits a beat in
+ * two) or a missed one (which doubles it) cannot move.  Each tap is then numbered with the beat it is closest
+ * to, counting from whichever tap the most others line up with, and taps more than Tolerance of a beat off their
+ * beat are dropped.  The beat length is the slope of a least-squares line through (beat, time) for the rest,
+ * which averages out the jitter of each tap much better than any single gap.  Everything works on a fixed-size
+ * window, so a tap costs the same however long the run is.  A pause of more than MaxInterval starts a new run,
+ * and taps closer than MinInterval are key bounces.
+ */
+struct TapTempo {
+	using TimePoint = std::chrono::steady_clock::time_point;
+	static constexpr std::size_t Window = 8;               ///<Taps the tempo is fitted to
+	static constexpr double Tolerance = 0.2;               ///<Largest distance of a tap from its beat, as a fraction of a beat
+	static constexpr long long MinInterval = 171428571;    ///<Shortest gap between taps (350 BPM, the fastest tempo)
+	static constexpr long long MaxInterval = 2000000000;   ///<Longest gap between taps before starting over (30 BPM)
+private:
+	std::array<long long,Window> m_Time {}; ///<Time of each tap in the window from the first tap of the run (nanoseconds), oldest first
+	std::size_t m_Count = 0;                ///<Taps in the window
+	TimePoint m_First;                      ///<First tap of the run
+	TimePoint m_Last;                       ///<Last tap
+	double m_Period = 0.0;                  ///<Fitted nanoseconds per beat (0 until there are two taps)
+
+	/** @brief Median gap between consecutive taps in the window */
+	double MedianInterval() const {
+		std::array<long long,Window - 1> Gaps;
+		std::size_t N = m_Count - 1;
+		for (std::size_t i = 0; i != N; i++) Gaps[i] = m_Time[i + 1] - m_Time[i];
+		auto Middle = Gaps.begin() + (std::ptrdiff_t)(N / 2);
+		std::nth_element(Gaps.begin(),Middle,Gaps.begin() + (std::ptrdiff_t)N);
+		return (double)*Middle;
+	}
+
+	/** @brief Beats from tap Reference to tap i for a beat length, or a negative fraction if tap i is off the beat */
+	double BeatOf(std::size_t i, std::size_t Reference, double Period) const {
+		double Beats = (double)(m_Time[i] - m_Time[Reference]) / Period;
+		double Nearest = std::round(Beats);
+		return (std::abs(Beats - Nearest) <= Tolerance) ? Nearest : -0.5;
+	}
+
+	/** @brief Refit the beat length to the taps in the window */
+	void Fit() {
+		double Rough = MedianInterval();
+		//count from the tap the most others agree with, so a stray tap is never the reference
+		std::size_t Reference = m_Count - 1, MostInliers = 0;
+		for (std::size_t j = m_Count; j-- != 0;) {
+			std::size_t Inliers = 0;
+			for (std::size_t i = 0; i != m_Count; i++) Inliers += (BeatOf(i,j,Rough) != -0.5);
+			if (Inliers > MostInliers) {
+				MostInliers = Inliers;
+				Reference = j;
+			}
+		}
+		//slope of time against beat for the taps on the beat, about the means so a long run does not lose precision
+		double MeanBeat = 0.0, MeanTime = 0.0;
+		for (std::size_t i = 0; i != m_Count; i++) {
+			double Beat = BeatOf(i,Reference,Rough);
+			if (Beat == -0.5) continue;
+			MeanBeat += Beat;
+			MeanTime += (double)m_Time[i];
+		}
+		MeanBeat /= (double)MostInliers;
+		MeanTime /= (double)MostInliers;
+		double Covariance = 0.0, Variance = 0.0;
+		for (std::size_t i = 0; i != m_Count; i++) {
+			double Beat = BeatOf(i,Reference,Rough);
+			if (Beat == -0.5) continue;
+			Covariance += (Beat - MeanBeat) * ((double)m_Time[i] - MeanTime);
+			Variance += (Beat - MeanBeat) * (Beat - MeanBeat);
+		}
+		m_Period = (Variance > 0.0) ? Covariance / Variance : Rough;
+	}
+public:
+	/** @brief Record a tap
+	 * @param At  When the key was pressed (as close to the input arriving as possible)
+	 * @return true if the tempo estimate changed (see BPM)
+	 */
+	bool Tap(TimePoint At) {
+		long long Interval = std::chrono::nanoseconds(At - m_Last).count();
+		if (m_Count != 0 && Interval < MinInterval) return false;
+		if (m_Count == 0 || Interval > MaxInterval) {
+			m_First = At;
+			m_Count = 0;
+			m_Period = 0.0;
+		}
+		if (m_Count == Window) {
+			for (std::size_t i = 1; i != Window; i++) m_Time[i - 1] = m_Time[i];
+			m_Count -= 1;
+		}
+		m_Time[m_Count++] = std::chrono::nanoseconds(At - m_First).count();
+		m_Last = At;
+		if (m_Count < 2) return false;
+		Fit();
+		return true;
+	}
+
+	/** @brief Forget every tap */
+	void Reset() {
+		m_Count = 0;
+		m_Period = 0.0;
+	}
+
+	/** @brief Taps in the window */
+	std::size_t Count() const {return m_Count;}
+
+	/** @brief Estimated tempo (0 until two taps have been made) */
+	double BPM() const {return (m_Period > 0.0) ? 60e9 / m_Period : 0.0;}
+};
+
+#endif
@@ -0,0 +1,192 @@
+#ifndef TEMPO_MAP_HPP_
+#define TEMPO_MAP_HPP_
+
+/** @file Tempo automation
+ * @brief Piecewise tempo (constant, linear and exponential ramps over bars) with beat times in closed form
+ */
+
+#include <algorithm> //upper_bound
+#include <array>     //array
+#include <cmath>     //log, log1p, expm1, pow, isfinite
+#include <cstddef>   //size_t
+#include <cstdlib>   //strtod
+
+/** @brief How the tempo moves from the start of a segment to its end */
+enum class TempoShape : unsigned char {
+	Constant,    ///<Holds the starting tempo
+	Linear,      ///<BPM changes by the same amount every beat
+	Exponential  ///<BPM changes by the same ratio every beat (sounds even over wide ranges)
+};
+
+/** @brief Tempo as a list of segments, each lasting a number of bars; the last tempo holds forever
+ * The time of any (fractional) beat is the start time of its segment plus the integral of the beat length over
+ * the segment, which has a closed form for each shape, so beat N is computed directly rather than by summing
+ * N periods: rounding never accumulates, whatever the tempo does over a two-hour rehearsal.  The inverse
+ * (beat at a time) is closed-form too.  Times are in nanoseconds from beat 0.
+ */
+struct TempoMap {
+	static constexpr int MaxSegments = 32; ///<Most segments in a map
+	/** @brief One section of the tempo */
+	struct Segment {
+		double Bars = 0.0;   ///<Length in bars
+		float From = 120.0f; ///<BPM at the start
+		float To = 120.0f;   ///<BPM at the end
+		TempoShape Shape = TempoShape::Constant;
+	};
+private:
+	std::array<Segment,MaxSegments> m_Segments {};
+	std::array<double,MaxSegments + 1> m_StartBeat {}; ///<First beat of each segment (and the end of the last)
+	std::array<double,MaxSegments + 1> m_StartTime {}; ///<Time of each segment's first beat (and the end of the last)
+	int m_Count = 0;                                   ///<Segments in use
+	float m_Hold = 120.0f;                             ///<Tempo after the last segment
+
+	static double NanosPerBeat(double BPM) {return 60e9 / BPM;}
+
+	/** @brief Segment containing a value of Starts (there must be a segment, and the value must not be before it) */
+	std::size_t Find(std::array<double,MaxSegments + 1> const &Starts, double V) const {
+		return (std::size_t)(std::upper_bound(Starts.begin() + 1,Starts.begin() + m_Count,V) - Starts.begin()) - 1;
+	}
+
+	/** @brief Nanoseconds from the start of a segment (Length beats long) to Beats into it */
+	static double TimeIn(Segment const &S, double Length, double Beats) {
+		double T0 = S.From, T1 = S.To;
+		if (S.Shape == TempoShape::Constant || T0 == T1 || Length <= 0.0) return Beats * NanosPerBeat(T0);
+		if (S.Shape == TempoShape::Linear) { //BPM(b) = T0 + (T1-T0) b/L, so t(b) = 60/(T1-T0) L ln(BPM(b)/T0)
+			double Slope = (T1 - T0) / Length;
+			return 60e9 / Slope * std::log1p(Slope * Beats / T0);
+		}
+		double K = std::log(T1 / T0) / Length; //BPM(b) = T0 e^(kb), so t(b) = 60/T0 (1 - e^(-kb))/k
+		return -NanosPerBeat(T0) * std::expm1(-K * Beats) / K;
+	}
+
+	/** @brief Beats from the start of a segment (Length beats long) to Nanos into it */
+	static double BeatsIn(Segment const &S, double Length, double Nanos) {
+		double T0 = S.From, T1 = S.To;
+		if (S.Shape == TempoShape::Constant || T0 == T1 || Length <= 0.0) return Nanos / NanosPerBeat(T0);
+		if (S.Shape == TempoShape::Linear) {
+			double Slope = (T1 - T0) / Length;
+			return T0 / Slope * std::expm1(Nanos * Slope / 60e9);
+		}
+		double K = std::log(T1 / T0) / Length;
+		return -std::log1p(-Nanos * K / NanosPerBeat(T0)) / K;
+	}
+public:
+	/** @brief A single tempo */
+	static TempoMap Constant(float BPM) {
+		TempoMap ret;
+		ret.m_Hold = BPM;
+		return ret;
+	}
+
+	/** @brief Practice ladder: Bars at From, then Bars at each Step up (or down) until To, which then holds
+	 * Returns false (leaving the map unchanged) if a tempo or the bars are invalid, Step does not lead from From
+	 * to To, or the steps do not fit in MaxSegments.
+	 */
+	bool Ladder(float From, float Step, double Bars, float To) {
+		if (!(From > 0.0f) || !(To > 0.0f) || !(Bars > 0.0) || !std::isfinite(Bars) || !std::isfinite(Step) || !((To - From) * Step > 0.0f)) return false;
+		TempoMap Built = Constant(To);
+		for (float BPM = From; (Step > 0.0f) ? BPM < To : BPM > To; BPM += Step) {
+			if (!Built.Add(Bars,BPM,BPM,TempoShape::Constant)) return false;
+		}
+		Built.m_Hold = To;
+		*this = Built;
+		return true;
+	}
+
+	/** @brief Append a segment; the tempo after it holds at To until another one is added
+	 * @return false if the map is full or the segment is invalid
+	 */
+	bool Add(double Bars, float From, float To, TempoShape Shape = TempoShape::Constant) {
+		if (m_Count == MaxSegments || !(Bars > 0.0) || !(From > 0.0f) || !(To > 0.0f)) return false;
+		m_Segments[(std::size_t)m_Count++] = Segment{Bars,From,Shape == TempoShape::Constant ? From : To,Shape};
+		m_Hold = m_Segments[(std::size_t)m_Count - 1].To;
+		return true;
+	}
+
+	/** @brief Parse a map such as "8@100,8@100-140,16@140,4@140~100"
+	 * Each comma-separated segment is <bars>@<bpm> (constant), <bars>@<bpm>-<bpm> (linear ramp) or
+	 * <bars>@<bpm>~<bpm> (exponential ramp).  Returns false (leaving the map unchanged) if the text is invalid.
+	 */
+	bool Parse(const char* Text) {
+		TempoMap Parsed;
+		const char* P = Text;
+		while (*P != '\0') {
+			char *End;
+			double Bars = std::strtod(P,&End);
+			if (End == P || *End != '@') return false;
+			P = End + 1;
+			double From = std::strtod(P,&End);
+			if (End == P) return false;
+			double To = From;
+			TempoShape Shape = TempoShape::Constant;
+			if (*End == '-' || *End == '~') {
+				Shape = (*End == '-') ? TempoShape::Linear : TempoShape::Exponential;
+				P = End + 1;
+				To = std::strtod(P,&End);
+				if (End == P) return false;
+			}
+			if (!Parsed.Add(Bars,(float)From,(float)To,Shape)) return false;
+			if (*End == ',') End += 1;
+			else if (*End != '\0') return false;
+			P = End;
+		}
+		if (Parsed.m_Count == 0) return false;
+		*this = Parsed;
+		return true;
+	}
+
+	/** @brief Whether the map is a single constant tempo */
+	bool Empty() const {return m_Count == 0;}
+
+	/** @brief Number of segments */
+	int Count() const {return m_Count;}
+
+	/** @brief Resolve bars into beats; must be called before the map is used for timing */
+	void Prepare(int BeatsPerBar) {
+		for (int i = 0; i != m_Count; i++) {
+			Segment const &S = m_Segments[(std::size_t)i];
+			double Length = S.Bars * (double)BeatsPerBar;
+			m_StartBeat[(std::size_t)i + 1] = m_StartBeat[(std::size_t)i] + Length;
+			m_StartTime[(std::size_t)i + 1] = m_StartTime[(std::size_t)i] + TimeIn(S,Length,Length);
+		}
+	}
+
+	/** @brief Tempo before beat 0, which the first segment (or the held tempo of an empty map) carries back */
+	float Lead() const {return (m_Count == 0) ? m_Hold : m_Segments[0].From;}
+
+	/** @brief Nanoseconds from beat 0 to a (fractional) beat (negative before beat 0) */
+	double Time(double Beat) const {
+		std::size_t End = (std::size_t)m_Count;
+		if (Beat < 0.0) return Beat * NanosPerBeat(Lead());
+		if (Beat >= m_StartBeat[End]) return m_StartTime[End] + (Beat - m_StartBeat[End]) * NanosPerBeat(m_Hold);
+		std::size_t i = Find(m_StartBeat,Beat);
+		return m_StartTime[i] + TimeIn(m_Segments[i],m_StartBeat[i + 1] - m_StartBeat[i],Beat - m_StartBeat[i]);
+	}
+
+	/** @brief (Fractional) beat at a number of nanoseconds from beat 0 */
+	double BeatAt(double Nanos) const {
+		std::size_t End = (std::size_t)m_Count;
+		if (Nanos < 0.0) return Nanos / NanosPerBeat(Lead());
+		if (Nanos >= m_StartTime[End]) return m_StartBeat[End] + (Nanos - m_StartTime[End]) / NanosPerBeat(m_Hold);
+		std::size_t i = Find(m_StartTime,Nanos);
+		return m_StartBeat[i] + BeatsIn(m_Segments[i],m_StartBeat[i + 1] - m_StartBeat[i],Nanos - m_StartTime[i]);
+	}
+
+	/** @brief Tempo at a (fractional) beat */
+	float BPMAt(double Beat) const {
+		std::size_t End = (std::size_t)m_Count;
+		if (Beat < 0.0) return Lead();
+		if (Beat >= m_StartBeat[End]) return m_Hold;
+		std::size_t i = Find(m_StartBeat,Beat);
+		Segment const &S = m_Segments[i];
+		double F = (Beat - m_StartBeat[i]) / (m_StartBeat[i + 1] - m_StartBeat[i]);
+		switch (S.Shape) {
+		case TempoShape::Constant: return S.From;
+		case TempoShape::Linear: return (float)(S.From + (S.To - S.From) * F);
+		case TempoShape::Exponential: return (float)(S.From * std::pow((double)S.To / S.From,F));
+		}
+		return S.From;
+	}
+};
+
+#endif
@@ -0,0 +1,355 @@
+#ifndef TIMING_THREAD_HPP_
+#define TIMING_THREAD_HPP_
+
+/** @file Timing thread
+ * @brief Owns the beat clock on its own thread so rendering and input can never delay a beat
+ */
+
+#include "Audio.hpp"
+#include "BeatPattern.hpp"
+#include "BeatScheduler.hpp"
+#include "EventLoop.hpp"
+#include "TempoMap.hpp"
+#include "Instrumentation.hpp"
+#include "Midi.hpp"
+#include "SPSCQueue.hpp"
+
+#include <algorithm> //min, max
+#include <atomic> //atomic
+#include <cerrno> //EAGAIN
+#include <cmath> //floor, llround
+#include <cstdlib> //llabs
+#include <thread> //thread
+
+#include <pthread.h>  //pthread_setschedparam
+#include <sched.h>    //SCHED_FIFO
+#include <sys/mman.h> //mlockall
+#include <unistd.h>   //read
+
+/** @brief Scheduling options for the timing thread */
+struct TimingThreadOptions {
+	bool RealTime = false;   ///<Request SCHED_FIFO for the timing thread
+	int Priority = 80;       ///<SCHED_FIFO priority
+	bool LockMemory = false; ///<mlockall() the process so the timing path never page-faults
+	ClickEngine *Clicks = nullptr; ///<Audio clicks to schedule on every beat (non-owning; null for silence)
+	MidiPort const *ClockIn = nullptr; ///<External MIDI clock to follow instead of the UI's tempo (non-owning; null for none)
+	MidiPort const *ClockOut = nullptr;///<Where to send MIDI clock generated from the beats (non-owning; null for none)
+	bool Manual = false;     ///<Run on the caller's time: beats are only delivered from Advance (eg: deterministic headless runs)
+};
+
+/** @brief When a tempo change takes effect */
+enum class TempoChange : unsigned char {
+	Immediate, ///<Straight away, carrying on from the current phase within the beat
+	NextBeat   ///<From the next beat, which keeps its deadline
+};
+
+/** @brief Runs a BeatScheduler on a dedicated thread and publishes every beat through a lock-free queue
+ * The render thread watches TickNotifier() (see EventLoop::Watch) and drains the queue with PopTick.  If the
+ * render thread stalls, beats still leave the timing thread on time and the stall shows up as several
+ * ticks being drained at once (a dropped frame) rather than as a late beat.
+ * Only Start begins a new grid: tempo and time signature changes carry on from the current beat and bar.
+ * When following an external MIDI clock, the clock is read on this thread (so each byte is timestamped as it
+ * arrives) and sets the tempo and the transport: Start only enables the beats, and the grid begins on the
+ * external clock's next beat, then is moved onto the follower's prediction of every beat halfway through the
+ * one before.  MIDI clock out is sent from this thread too, each pulse written when its point on the grid is due.
+ * With Options::Manual the thread never looks at the steady clock: time only moves when the caller Advances it,
+ * and ticks are only published from Advance, which waits for them, so a run is the same every time.
+ */
+struct TimingThread {
+	using Clock = BeatScheduler::Clock;
+	using TimePoint = BeatScheduler::TimePoint;
+	using Tick = BeatScheduler::Tick;
+	using Nanoseconds = BeatScheduler::Nanoseconds;
+
+	using Options = TimingThreadOptions;
+private:
+	/** @brief Requests from the render thread */
+	struct Command {
+		enum class Type : unsigned char {Start, Retime, Meter, Stop, Advance, Quit};
+		Type Kind = Type::Stop;
+		TimePoint Anchor;   ///<Start: time of beat 0; Retime: time of the change; Advance: the caller's time
+		TempoMap Tempo;     ///<Start, Retime: tempo of every beat (prepared)
+		BeatPattern Pattern;///<Start, Meter: events of each beat and subdivision of the bar
+		TempoChange When = TempoChange::Immediate; ///<Retime: when the new tempo takes over
+	};
+
+	/** @brief A beat pattern placed on the beat grid */
+	struct Meter {
+		BeatPattern Pattern; ///<Events of the bar
+		long long Origin = 1;///<A beat that is a downbeat
+		long long From = 1;  ///<First beat the pattern applies to
+		MidiSongMap Song;    ///<Pulses of MIDI clock from beat From, in the pattern's note value
+		/** @brief Place of beat N in the bar */
+		BeatEvent At(long long N) const {return Pattern.AtBeat(N - Origin);}
+	};
+
+	SPSCQueue<Command,64> m_Commands;   ///<Render thread -> timing thread
+	SPSCQueue<Tick,256> m_Ticks;        ///<Timing thread -> render thread
+	EventNotifier m_CommandNotify;      ///<Wakes the timing thread when a command is queued
+	EventNotifier m_TickNotify;         ///<Wakes the render thread when a tick is queued
+	std::atomic<bool> m_RealTime {false};    ///<Whether SCHED_FIFO was granted
+	std::atomic<long long> m_Overflows {0};  ///<Ticks dropped because the render thread fell too far behind
+	std::atomic<long long> m_Lead {0};       ///<Nanoseconds ahead of each deadline that ticks are issued
+	std::atomic<long long> m_Advanced {0};   ///<Advance commands the timing thread has finished
+	long long m_Advances = 0;                ///<Advance commands sent (render thread only)
+	bool m_Following = false;                ///<Whether the tempo comes from an external clock
+	std::thread m_Thread;
+
+	void Send(Command const &C) {
+		while (!m_Commands.Push(C)) std::this_thread::yield(); //only fills up if the timing thread is wedged
+		m_CommandNotify.Notify();
+	}
+
+	/** @brief How far ahead of its deadline the next tick is issued
+	 * Never more than half a beat early, so a tick is still issued closest to the beat it belongs to.
+	 */
+	Nanoseconds LeadFor(BeatScheduler const &Beats) const {
+		return Nanoseconds(std::min(m_Lead.load(std::memory_order_relaxed),(long long)(Beats.Period() / 2.0)));
+	}
+
+	/** @brief Queue the clicks of a beat and its subdivisions that are still to be heard after a point in time */
+	static void ScheduleClick(ClickEngine *Clicks, BeatScheduler const &Beats, Meter const &M, long long Beat, TimePoint After = TimePoint::min()) {
+		if (!Clicks) return;
+		int Subdivisions = M.Pattern.Subdivisions();
+		long long Step = (Beat - M.Origin) * Subdivisions;
+		for (int k = 0; k != Subdivisions; k++) {
+			TimePoint When = Beats.At((double)Beat + (double)k / (double)Subdivisions); //subdivisions follow tempo ramps too
+			if (When - Clicks->Latency() > After) Clicks->Schedule(When,M.Pattern.At(Step + k));
+		}
+	}
+
+	/** @brief Drop the clicks queued so far and queue them again from Now, after the tempo or pattern changed */
+	static void RescheduleClicks(ClickEngine *Clicks, BeatScheduler const &Beats, Meter const &Current, Meter const &Next, TimePoint Now) {
+		if (!Clicks) return;
+		Clicks->Cancel(); //clicks already sounding ring out
+		long long Beat = Beats.NextBeat();
+		ScheduleClick(Clicks,Beats,(Beat - 1 >= Next.From) ? Next : Current,Beat - 1,Now); //rest of the beat playing now
+		ScheduleClick(Clicks,Beats,(Beat >= Next.From) ? Next : Current,Beat,Now);
+	}
+
+	/** @brief Body of the timing thread */
+	void Run(Options O) {
+		if (O.LockMemory) ::mlockall(MCL_CURRENT | MCL_FUTURE);
+		if (O.RealTime) {
+			sched_param Param {};
+			Param.sched_priority = O.Priority;
+			m_RealTime = (pthread_setschedparam(pthread_self(), SCHED_FIFO, &Param) == 0); //EPERM without CAP_SYS_NICE/rtprio
+		}
+		BeatScheduler Beats;
+		EventLoop Loop(m_CommandNotify.FD());
+		bool Ticking = false;
+		Meter Current;  //pattern of the beats being delivered
+		Meter Next;     //pattern waiting for its first beat (the same as Current when none is)
+		MidiClockFollower Follower;
+		bool Enabled = false; //following: whether beats were asked for
+		bool Locked = false;  //following: whether the follower was locked at the last pulse
+		MidiClockSender Sender(O.ClockOut);
+		TimePoint Manual;     //the caller's time (Options::Manual)
+		auto Now = [&O,&Manual]() {return O.Manual ? Manual : Clock::now();};
+		//pulse P of the song is on the grid through the song map of the pattern it falls in
+		auto SongAt = [&Current,&Next](long long P) -> MidiSongMap const & {return (P >= Next.Song.Pulse) ? Next.Song : Current.Song;};
+		if (O.ClockIn) Loop.Watch(O.ClockIn->FD());
+		while (true) {
+			Nanoseconds Lead = LeadFor(Beats);
+			Loop.ArmDeadline((Ticking && !O.Manual) ? std::min(Beats.NextDeadline() - Lead,Sender.Next(Beats,SongAt(Sender.Pulse()))) : TimePoint::max());
+			EventLoop::Events E = Loop.Wait();
+			if (E.Input) m_CommandNotify.Drain();
+			bool Advanced = false; //a manual clock moved: publish what is due by then, and only then
+			Command C;
+			while (m_Commands.Pop(C)) {
+				switch (C.Kind) {
+				case Command::Type::Start:
+					Current = Meter{C.Pattern,1,1,MidiSongMap::Song(C.Pattern.NoteValue())}; //the first beat after a start is the downbeat
+					Next = Current;
+					if (m_Following) {
+						Enabled = true;
+						break;
+					}
+					Beats.Start(C.Anchor,C.Tempo);
+					Ticking = true;
+					Sender.Start(Current.Song,Beats.NextBeat());
+					if (O.Clicks) O.Clicks->Cancel();
+					ScheduleClick(O.Clicks,Beats,Current,Beats.NextBeat()); //a whole beat ahead, so the click is mixed on time
+					break;
+				case Command::Type::Retime:
+					if (!Ticking || m_Following) break;
+					if (C.When == TempoChange::Immediate) Beats.Retime(C.Anchor,C.Tempo);
+					else Beats.RetimeAtNextBeat(C.Tempo);
+					RescheduleClicks(O.Clicks,Beats,Current,Next,Now());
+					break;
+				case Command::Type::Meter: {
+					if (!Ticking) break;
+					//a new count of beats starts at the next bar line, anything else (eg: subdivisions) at the next beat
+					Meter Base = (Beats.NextBeat() >= Next.From) ? Next : Current; //a copy: Next is overwritten below
+					Next = Meter{C.Pattern,Base.Origin,Beats.NextBeat(),MidiSongMap()};
+					if (C.Pattern.BeatsPerBar() != Base.Pattern.BeatsPerBar()) {
+						long long Bar = Base.Pattern.BeatsPerBar();
+						Next.Origin = Base.Origin + (std::max(Beats.NextBeat() - Base.Origin,0LL) + Bar - 1) / Bar * Bar;
+						Next.From = Next.Origin;
+					}
+					Next.Song = Base.Song.Then(Next.From,C.Pattern.NoteValue());
+					RescheduleClicks(O.Clicks,Beats,Current,Next,Now());
+					break;
+				}
+				case Command::Type::Stop:
+					Ticking = false;
+					Enabled = false;
+					Sender.Stop();
+					if (O.Clicks) O.Clicks->Cancel();
+					break;
+				case Command::Type::Advance:
+					Manual = C.Anchor;
+					Advanced = true;
+					break;
+				case Command::Type::Quit:
+					Sender.Stop();
+					return;
+				}
+			}
+			while (E.Notified && O.ClockIn) {
+				unsigned char Bytes[64];
+				ssize_t Read = ::read(O.ClockIn->FD(),Bytes,sizeof(Bytes));
+				if (Read <= 0) {
+					if (Read == 0 || (errno != EAGAIN && errno != EINTR)) Loop.Watch(-1); //the device went away
+					break;
+				}
+				for (ssize_t i = 0; i != Read; i++) {
+					MidiClockEvent Event = Follower.Feed(Bytes[i],E.Woken);
+					if (Follower.Locked() && !Locked) Metrics().ClockLockTime.store(Follower.LockTime().count(),std::memory_order_relaxed);
+					Locked = Follower.Locked();
+					if (Event == MidiClockEvent::Start || Event == MidiClockEvent::Continue || Event == MidiClockEvent::Stop) {
+						Ticking = false; //a start or continue begins the grid again on its first pulse
+						if (O.Clicks) O.Clicks->Cancel();
+						if (Event == MidiClockEvent::Stop) Sender.Stop();
+					}
+					if (Event != MidiClockEvent::Pulse || !Enabled || !Follower.HasTempo()) continue;
+					long long N = Follower.Pulse();
+					MidiSongMap const &Song = SongAt(N); //the clock counts quarter notes, the grid the signature's
+					long long Beat = (long long)std::floor(Song.BeatOf(N + Song.PerBeat - 2)); //the next beat, or the one that began a pulse ago (it takes two pulses to know the tempo)
+					double Period = Follower.BeatPeriod() * (double)Song.PerBeat / (double)MidiClockFollower::PPQN;
+					TempoMap Tempo = TempoMap::Constant((float)(60e9 / Period));
+					if (!Ticking) { //beat 1 of the grid, its downbeat, is the first beat of the song
+						Beats.Start(Follower.PulseAt(Song.PulseAt((double)Beat)) - Nanoseconds(std::llround(Period * (double)Beat)),Tempo,Beat);
+						Ticking = true;
+						if (O.Clicks) O.Clicks->Cancel();
+						ScheduleClick(O.Clicks,Beats,Current,Beats.NextBeat());
+						Sender.Start(Song,Beats.NextBeat());
+					} else if (Song.Into(N) == 0) {
+						Metrics().ClockPhase.Record(std::llabs((long long)Nanoseconds(Follower.Arrival() - Beats.Deadline(Beat)).count()));
+					} else if (Song.Into(N) == Song.PerBeat / 2) { //halfway through a beat, clear of the ticks on either side
+						Beats.Align(Beat,Follower.PulseAt(Song.PulseAt((double)Beat)),Tempo);
+						RescheduleClicks(O.Clicks,Beats,Current,Next,Now());
+					}
+				}
+			}
+			bool Due = Ticking && (!O.Manual || Advanced);
+			if (Due) Sender.Send(Beats,SongAt(Sender.Pulse()),Now());
+			Lead = LeadFor(Beats); //the commands may have changed the tempo or the lead
+			Tick T;
+			if (Due && Beats.Poll(Now() + Lead,T)) {
+				T.Lead = Lead;
+				if (T.Index >= Next.From) Current = Next;
+				T.Event = Current.At(T.Index);
+				Metrics().TickLateness.Record(T.Lateness);
+				ScheduleClick(O.Clicks,Beats,(Beats.NextBeat() >= Next.From) ? Next : Current,Beats.NextBeat());
+				if (m_Ticks.Push(T)) m_TickNotify.Notify();
+				else m_Overflows.fetch_add(1,std::memory_order_relaxed);
+			}
+			if (Advanced) m_Advanced.fetch_add(1,std::memory_order_release);
+		}
+	}
+public:
+	TimingThread(const TimingThread&) = delete;
+	TimingThread& operator=(const TimingThread&) = delete;
+
+	TimingThread(Options O = Options()) : m_Following(O.ClockIn != nullptr) {
+		m_Thread = std::thread(&TimingThread::Run,this,O);
+	}
+	~TimingThread() {
+		Command C;
+		C.Kind = Command::Type::Quit;
+		Send(C);
+		m_Thread.join();
+	}
+
+	/** @brief (Re)start the beat grid with beat 0 at Anchor */
+	void Start(TimePoint Anchor, double BPM, BeatPattern const &Pattern = BeatPattern()) {
+		Start(Anchor,TempoMap::Constant((float)BPM),Pattern);
+	}
+
+	/** @brief (Re)start the beat grid with beat 0 at Anchor, following a tempo map whose segments are in bars of Pattern */
+	void Start(TimePoint Anchor, TempoMap const &Tempo, BeatPattern const &Pattern) {
+		Command C;
+		C.Kind = Command::Type::Start;
+		C.Anchor = Anchor;
+		C.Tempo = Tempo;
+		C.Tempo.Prepare(Pattern.BeatsPerBar());
+		C.Pattern = Pattern;
+		Send(C);
+	}
+
+	/** @brief Change the tempo of a running grid without restarting it: the beat count and the bar carry on */
+	void Retime(TimePoint Now, double BPM, TempoChange When = TempoChange::Immediate) {
+		Command C;
+		C.Kind = Command::Type::Retime;
+		C.Anchor = Now;
+		C.Tempo = TempoMap::Constant((float)BPM);
+		C.When = When;
+		Send(C);
+	}
+
+	/** @brief Change the time signature or subdivisions of a running grid
+	 * A different number of beats per bar takes over at the next downbeat, so the bar being played is finished;
+	 * other changes take over at the next beat.
+	 */
+	void SetPattern(BeatPattern const &Pattern) {
+		Command C;
+		C.Kind = Command::Type::Meter;
+		C.Pattern = Pattern;
+		Send(C);
+	}
+
+	/** @brief Move the time of a manual clock (see Options::Manual) on to Now and publish the tick due by then
+	 * Returns once the timing thread has caught up, so the tick (if any) can be taken with PopTick straight away.
+	 */
+	void Advance(TimePoint Now) {
+		Command C;
+		C.Kind = Command::Type::Advance;
+		C.Anchor = Now;
+		Send(C);
+		m_Advances += 1;
+		while (m_Advanced.load(std::memory_order_acquire) != m_Advances) std::this_thread::yield();
+	}
+
+	/** @brief Issue ticks this far ahead of their deadlines, to make up for the latency of the visual output */
+	void SetLead(Nanoseconds Lead) {
+		m_Lead.store(std::max((long long)Lead.count(),0LL),std::memory_order_relaxed);
+	}
+
+	/** @brief Stop delivering beats */
+	void Stop() {
+		Command C;
+		C.Kind = Command::Type::Stop;
+		Send(C);
+	}
+
+	/** @brief Notifier that fires whenever a tick is queued */
+	EventNotifier const &TickNotifier() const {return m_TickNotify;}
+
+	/** @brief Take the oldest pending tick (render thread only); call after draining the notifier */
+	bool PopTick(Tick &T) {return m_Ticks.Pop(T);}
+
+	/** @brief Clear the tick notifier before draining the queue */
+	void AcknowledgeTicks() {m_TickNotify.Drain();}
+
+	/** @brief Whether the tempo comes from an external clock rather than Start and Retime */
+	bool Following() const {return m_Following;}
+
+	/** @brief Whether the timing thread is running under SCHED_FIFO */
+	bool IsRealTime() const {return m_RealTime;}
+
+	/** @brief Number of ticks dropped because the tick queue was full */
+	long long Overflows() const {return m_Overflows;}
+};
+
+#endif
@@ -15,6 +15,20 @@ enum class Location {
 	West       ///<Left of the screen
 };
 
+/** @brief Windows a drawer lays out, in the order they are refreshed */
+enum class Pane : unsigned char {
+	Input = 0, ///<User interface panel (on the Orientation side of the screen)
+	Visual,    ///<Visualizations (the rest of the screen)
+	Count      ///<Number of panes
+};
+
+/** @brief Resolution that primitives are rasterized at */
+enum class SubCellMode : unsigned char {
+	Cell,      ///<One pixel per character cell
+	HalfBlock, ///<1x2 pixels per cell, packed into half-block glyphs
+	Braille    ///<2x4 pixels per cell, packed into Braille glyphs
+};
+
 /** @brief A data structure for an arbitrary box */
 template <typename NumberType = int>
 struct BoxSize {
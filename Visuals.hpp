@@ -0,0 +1,280 @@
+#ifndef VISUALS_HPP_
+#define VISUALS_HPP_
+
+/** @file Visualizations
+ * @brief Backend-independent visualizations drawn through the WindowHandle interface
+ */
+
+#include "Interface.hpp"
+#include "Instrumentation.hpp"
+#include "Pendulum.hpp"
+#include "Progress.hpp"
+#include "Raindrops.hpp"
+#include "Types.hpp"
+
+#include <array>  //array
+#include <chrono> //std::chrono
+#include <cstddef> //size_t
+#include <memory> //unique_ptr
+
+/** @brief VisualOutput that draws everything through WindowHandle primitives, so any backend can use it
+ * Window is the concrete window type; with a final backend window every primitive call binds at compile time.
+ * WindowVisual<WindowHandle> draws through the virtual interface instead.
+ */
+template <typename Window>
+struct WindowVisual final : public VisualOutput {
+	static constexpr std::chrono::nanoseconds FrameInterval {16666667}; ///<Frame period for continuously moving visuals
+private:
+	bool FlashState = false; ///<The flashing state
+	bool Colors = true;      ///<Whether the window can display colours
+	PendulumCache Pendulum;  ///<Pre-rendered pendulum swing
+	int PendulumFrame = -1;  ///<Pendulum frame on screen (-1 if none)
+	bool Repainted = false;  ///<The whole window was filled since the pendulum was drawn
+	RainSystem Rain;         ///<Raindrop particles
+	std::chrono::steady_clock::time_point RainTick; ///<Beat the last wave of drops was spawned on
+	std::chrono::steady_clock::time_point RainTime; ///<Time the drops were last moved to
+	bool RainShown = false;  ///<Whether drops are on screen
+	ProgressBar Progress;    ///<Beat progress bar
+	std::chrono::steady_clock::time_point ProgressTick; ///<Beat the current sweep started on
+	bool ProgressShown = false; ///<Whether the bar is on screen
+	BoxSize<int> ProgressSize {0,0}; ///<Window size the bar was drawn at
+
+	/** @brief The window drawn into, with its full type */
+	Window &Out() const {return *static_cast<Window*>(Win);}
+
+	/** @brief Colour index for the selected colour scheme */
+	unsigned char SchemeColor(UserInterface const &UI) const {return Colors ? (unsigned char)(UI.Color+2) : 1;}
+
+	/** @brief Fraction of the current beat that has elapsed */
+	float BeatFraction(UserInterface const &UI) const {
+		double Elapsed = (double)std::chrono::nanoseconds(Now() - LastTick).count();
+		return (float)std::min(Elapsed / BeatNanos(UI),1.0);
+	}
+
+	/** @brief Whether one of the raindrop visualizations is selected */
+	static bool RaindropsSelected(UserInterface const &UI) {
+		Visualization V = (Visualization)UI.VisualizationType;
+		return V == Visualization::ParticlesTopDown || V == Visualization::ParticlesBottomUp ||
+		       V == Visualization::ParticlesLeftToRight || V == Visualization::ParticlesRightToLeft;
+	}
+
+	/** @brief Whether the pendulum is the selected visualization */
+	static bool PendulumSelected(UserInterface const &UI) {return (Visualization)UI.VisualizationType == Visualization::Pendulum;}
+
+	/** @brief Fill for a flash on the last beat: the downbeat flashes white, accents solid, other beats textured */
+	ColorType<unsigned char> FlashColor(UserInterface const &UI) const {
+		struct Style {bool White; unsigned char Alpha;};
+		static constexpr Style Styles[(std::size_t)BeatEvent::Count] = {{true,255},{false,255},{false,200},{false,0}};
+		if (!Colors) return {1,0,0,255};
+		Style const &S = Styles[(std::size_t)LastEvent];
+		return {S.White ? (unsigned char)9 : (unsigned char)(UI.Color+2),0,0,S.Alpha};
+	}
+
+	/** @brief Sets the flash state on the screen */
+	void SetFlashState(bool State, UserInterface const &UI) {
+		FlashState = State;
+		Repainted = true;
+		if (State) Out().FillScreen(FlashColor(UI));
+		else       Out().FillScreen({0,0,0,0}); //FIXME: this should be 2; why does only 1 work?
+	}
+public:
+	/**
+	 * @param W          Window to draw into (non-owning)
+	 * @param HasColors  Whether the window supports colour
+	 * @param Clock      Where the current time comes from (non-owning; null for the steady clock)
+	 */
+	WindowVisual(Window* W, bool HasColors, FrameClock const *Clock = nullptr) {
+		Win = W;
+		Colors = HasColors;
+		Time = Clock;
+		LastTick = Now();
+		TickTimer = LastTick;
+		RainTime = LastTick;
+		RainTick = LastTick;
+	}
+	virtual ~WindowVisual() = default;
+
+	/** @brief Draw a flash on the screen */
+	virtual void DrawFlash(UserInterface const &UI) override { //FIXME: very sloppy for now; Definitely need to fix how we output to the window;
+		auto At = Now();
+		if (FlashState && At >= TickTimer + FlashDuration(UI.BPM)) {
+			SetFlashState(false,UI);
+		}
+		if (BeatPending) {
+			BeatPending = false;
+			SetFlashState(true,UI);
+			TickTimer = At;
+			Metrics().FlashLatency.Record(At - LastTick);
+		}
+	}
+	/** @brief Draw the pendulum from its frame cache; only frames whose phase changed are blitted */
+	virtual void DrawMetronome(UserInterface const &UI) override {
+		if (!PendulumSelected(UI)) {
+			if (PendulumFrame >= 0 && !Repainted) Out().DrawSprite(Pendulum.Frame(PendulumFrame),true);
+			PendulumFrame = -1;
+			return;
+		}
+		if (!Pendulum.Matches(Out().GetSize(),UI.BPM,SchemeColor(UI))) {
+			Pendulum.Build(Out(),UI.BPM,SchemeColor(UI));
+			SetFlashState(FlashState,UI); //building leaves the window blank
+			PendulumFrame = -1;
+		}
+		int Frame = UI.Flashing ? Pendulum.FrameAt(Now() - LastTick,LastBeat,BeatBPM(UI)) : Pendulum.RestingFrame();
+		if (Frame == PendulumFrame && !Repainted) return;
+		if (PendulumFrame >= 0 && !Repainted) Out().DrawSprite(Pendulum.Frame(PendulumFrame),true);
+		Out().DrawSprite(Pendulum.Frame(Frame));
+		PendulumFrame = Frame;
+		Repainted = false;
+	}
+	/** @brief Move and draw the raindrops; each beat spawns a wave that lands on the following beat */
+	virtual void DrawRaindrops(UserInterface const &UI) override {
+		auto At = Now();
+		if (!RaindropsSelected(UI)) {
+			if (RainShown) SetFlashState(FlashState,UI); //wipe the last drops
+			Rain.Clear();
+			RainShown = false;
+			RainTime = At;
+			return;
+		}
+		Rain.Update(At - RainTime);
+		RainTime = At;
+		if (UI.Flashing && LastTick != RainTick) {
+			RainTick = LastTick;
+			auto Deadline = LastTick + std::chrono::nanoseconds((long long)BeatNanos(UI));
+			Rain.SpawnWave((Visualization)UI.VisualizationType,Out().GetSize(),Deadline - At);
+		}
+		if (Rain.Count() == 0 && !RainShown) return;
+		SetFlashState(FlashState,UI); //drops move every frame, so start from a clean background
+		Rain.Draw(Out(),SchemeColor(UI));
+		RainShown = Rain.Count() > 0;
+	}
+	/** @brief Advance the progress bar; only the band it moved by since the last frame is drawn */
+	virtual void DrawProgress(UserInterface const &UI) override {
+		Visualization V = (Visualization)UI.VisualizationType;
+		if (!ProgressBar::IsProgress(V)) {
+			if (ProgressShown) SetFlashState(FlashState,UI); //wipe the bar
+			ProgressShown = false;
+			Progress.Start(true);
+			return;
+		}
+		BoxSize<int> Size = Out().GetSize();
+		if (Size.X != ProgressSize.X || Size.Y != ProgressSize.Y) { //the part already swept is redrawn at the new size
+			Progress.Resize(V,ProgressSize,Size);
+			ProgressSize = Size;
+			ProgressShown = false;
+		}
+		if (!ProgressShown || Repainted) {
+			Progress.Repaint(Out(),V,SchemeColor(UI));
+			ProgressShown = true;
+			Repainted = false;
+		}
+		if (!UI.Flashing) return;
+		if (LastTick != ProgressTick) { //finish the previous sweep, then start the next one
+			Progress.Advance(Out(),V,1.0f,SchemeColor(UI));
+			Progress.Start(LastBeat & 1);
+			ProgressTick = LastTick;
+		}
+		Progress.Advance(Out(),V,BeatFraction(UI),SchemeColor(UI));
+	}
+
+	virtual void ForceRedraw() override {
+		Pendulum.Invalidate(); //the window may have changed size
+		ProgressShown = false; //and may have been cleared
+		Out().Redraw();
+	}
+
+	/** @brief Next flash-off edge or pendulum frame change (flash-on edges arrive from the beat clock) */
+	virtual std::chrono::steady_clock::time_point NextDeadline(UserInterface const &UI) const override {
+		auto Next = std::chrono::steady_clock::time_point::max();
+		if (FlashState) Next = TickTimer + FlashDuration(UI.BPM);
+		if (ProgressBar::IsProgress((Visualization)UI.VisualizationType) && UI.Flashing) {
+			float Fraction = BeatFraction(UI);
+			float Step = Progress.NextStep((Visualization)UI.VisualizationType,Out().GetSize(),Fraction,4); //4: finest sub-cell step
+			if (Step > Fraction) Next = std::min(Next,LastTick + std::chrono::nanoseconds((long long)(Step * BeatNanos(UI))));
+		}
+		if (RaindropsSelected(UI) && Rain.Count() > 0) {
+			Next = std::min(Next,RainTime + FrameInterval);
+		}
+		if (PendulumSelected(UI) && UI.Flashing && Pendulum.Phases() > 0) {
+			auto SinceBeat = Now() - LastTick;
+			auto Change = Pendulum.NextChange(SinceBeat,BeatBPM(UI));
+			if (Change > SinceBeat) Next = std::min(Next,LastTick + Change); //otherwise the next beat moves it
+		}
+		return Next;
+	}
+};
+
+/** @brief Drawer for backends whose windows are all of one type
+ * The visual output is owned with its full type, so the per-frame calls into it (and from it into the window)
+ * bind at compile time and can inline.  The Drawer virtuals remain for code that only knows the interface.
+ * Windows are kept in a table indexed by Pane, which is also the order they are refreshed in.
+ */
+template <typename Window>
+struct WindowDrawer : public Drawer {
+protected:
+	std::array<std::unique_ptr<Window>,(std::size_t)Pane::Count> m_Children; ///<Windows, indexed by Pane
+	std::unique_ptr<WindowVisual<Window>> m_Visual = nullptr; ///<Visual output (m_VOut points at it)
+
+	/** @brief Create a pane's window in its place for the current orientation */
+	Window &CreatePane(Pane P) {
+		PaneGeometry G = Layout(P,GetWindowSize());
+		m_Children[(std::size_t)P] = std::make_unique<Window>(G.Height,G.Width,G.Y,G.X);
+		return *m_Children[(std::size_t)P];
+	}
+
+	/** @brief Resize and move every window to its place for the current orientation and screen size */
+	void LayoutPanes() {
+		BoxSize<int> Screen = GetWindowSize();
+		for (std::size_t i = 0; i != m_Children.size(); i++) {
+			if (!m_Children[i]) continue;
+			PaneGeometry G = Layout((Pane)i,Screen);
+			m_Children[i]->resize(G.Height,G.Width);
+			m_Children[i]->move(G.Y,G.X);
+		}
+	}
+
+	/** @brief Destroy every window (eg: before the terminal is restored) */
+	void DestroyPanes() {
+		m_VOut = nullptr;
+		m_Visual.reset();
+		for (auto &Child : m_Children) Child.reset();
+	}
+
+	/** @brief Lay the windows out again after the screen size or orientation changed */
+	virtual void ProcessResize() = 0;
+
+	/** @brief Create the visual output for a window */
+	void CreateVisual(Window *W, bool HasColors) {
+		m_Visual = std::make_unique<WindowVisual<Window>>(W,HasColors,m_Clock);
+		m_VOut = m_Visual.get();
+	}
+
+	/** @brief Draw every visualization (after invalidating the whole output if Force) */
+	void DrawVisuals(UserInterface const &UI, bool Force) {
+		if (!m_Visual) return;
+		if (Force) m_Visual->ForceRedraw();
+		m_Visual->DrawFlash(UI);
+		m_Visual->DrawMetronome(UI);
+		m_Visual->DrawRaindrops(UI);
+		m_Visual->DrawProgress(UI);
+	}
+public:
+	/** @brief A pane's window */
+	Window &Child(Pane P) {return *m_Children[(std::size_t)P];}
+
+	/** @brief Move the user interface to another side of the screen (rearranging existing windows) */
+	virtual void SetOrientation(Location L) override {
+		Orientation = L;
+		if (m_Children[(std::size_t)Pane::Input]) ProcessResize();
+	}
+
+	virtual std::chrono::steady_clock::time_point NextDeadline(UserInterface const &UI) override {
+		if (!m_Visual) return std::chrono::steady_clock::time_point::max();
+		return m_Visual->NextDeadline(UI);
+	}
+	virtual void OnBeat(BeatScheduler::Tick const &T) override {
+		if (m_Visual) m_Visual->OnBeat(T);
+	}
+};
+
+#endif